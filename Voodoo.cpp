@@ -1,3 +1,29 @@
+#ifdef __linux__
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#endif
+
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+
 #include <log.hpp>
 
 #include "Voodoo.h"
@@ -6,6 +32,23 @@
 namespace Voodoo {
 
 
+/*
+ * Version of the value encoding, see Packet, checked when connecting.
+ */
+static const sf::Uint32 WIRE_VERSION = 2;
+
+/*
+ * Request checking the version, the slot index zero never identifies a method.
+ */
+static const ID CHECK_VERSION(1ULL << 32);
+
+/*
+ * Largest packet accepted by channels framing packets themselves, so a peer can not make
+ * the server allocate an arbitrary amount of memory by sending a bogus size.
+ */
+static const size_t MAX_PACKET_SIZE = 1 << 28;
+
+
 sf::Packet& operator <<(sf::Packet& packet, const ID& id)
 {
 	return packet << *id;
@@ -23,64 +66,342 @@ sf::Packet& operator >>(sf::Packet& packet, ID& id)
 }
 
 
-Host::Host()
+Reader::Reader(const void* data, size_t size, std::shared_ptr<const void> owner)
+	:
+	data((const sf::Uint8*)data),
+	size(size),
+	position(0),
+	owner(owner),
+	tagged(true)
+{
+}
+
+Reader::Reader(const sf::Packet& packet, size_t position)
+	:
+	data((const sf::Uint8*)packet.getData()),
+	size(packet.getDataSize()),
+	position(position),
+	tagged(true)
+{
+	if (position > size)
+		throw std::runtime_error("truncated packet");
+}
+
+Reader::Reader(std::shared_ptr<const sf::Packet> packet, size_t position)
 	:
-	ids(0)
+	Reader(*packet, position)
+{
+	owner = packet;
+}
+
+bool Reader::EndOfData() const
+{
+	return position >= size;
+}
+
+size_t Reader::GetPosition() const
+{
+	return position;
+}
+
+bool Reader::IsTagged() const
+{
+	return tagged;
+}
+
+void Reader::SetTagged(bool tagged)
+{
+	this->tagged = tagged;
+}
+
+const sf::Uint8* Reader::take(size_t length)
+{
+	if (length > size - position)
+		throw std::runtime_error("truncated packet");
+
+	const sf::Uint8* ptr = data + position;
+
+	position += length;
+
+	return ptr;
+}
+
+/*
+ * Integers are in network byte order, floats in host byte order (same as sf::Packet).
+ */
+template <typename T>
+static T read_integer(const sf::Uint8* ptr)
+{
+	T value = 0;
+
+	for (size_t i = 0; i < sizeof(T); i++)
+		value = (T)((value << 8) | ptr[i]);
+
+	return value;
+}
+
+Reader& Reader::operator >>(sf::Int8& value)
+{
+	value = (sf::Int8)*take(sizeof(value));
+	return *this;
+}
+
+Reader& Reader::operator >>(sf::Uint8& value)
+{
+	value = *take(sizeof(value));
+	return *this;
+}
+
+Reader& Reader::operator >>(sf::Int16& value)
+{
+	value = (sf::Int16)read_integer<sf::Uint16>(take(sizeof(value)));
+	return *this;
+}
+
+Reader& Reader::operator >>(sf::Uint16& value)
+{
+	value = read_integer<sf::Uint16>(take(sizeof(value)));
+	return *this;
+}
+
+Reader& Reader::operator >>(sf::Int32& value)
+{
+	value = (sf::Int32)read_integer<sf::Uint32>(take(sizeof(value)));
+	return *this;
+}
+
+Reader& Reader::operator >>(sf::Uint32& value)
+{
+	value = read_integer<sf::Uint32>(take(sizeof(value)));
+	return *this;
+}
+
+Reader& Reader::operator >>(sf::Int64& value)
+{
+	value = (sf::Int64)read_integer<sf::Uint64>(take(sizeof(value)));
+	return *this;
+}
+
+Reader& Reader::operator >>(sf::Uint64& value)
+{
+	value = read_integer<sf::Uint64>(take(sizeof(value)));
+	return *this;
+}
+
+Reader& Reader::operator >>(float& value)
+{
+	memcpy(&value, take(sizeof(value)), sizeof(value));
+	return *this;
+}
+
+Reader& Reader::operator >>(double& value)
+{
+	memcpy(&value, take(sizeof(value)), sizeof(value));
+	return *this;
+}
+
+Reader& Reader::operator >>(std::string& value)
+{
+	sf::Uint32 length;
+
+	*this >> length;
+
+	value.assign((const char*)take(length), length);
+
+	return *this;
+}
+
+Reader& Reader::operator >>(ID& value)
+{
+	sf::Uint64 v;
+
+	*this >> v;
+
+	value = ID(v);
+
+	return *this;
+}
+
+sf::Uint64 Reader::ReadVarint()
+{
+	sf::Uint64 value = 0;
+
+	for (int shift = 0; shift < 64; shift += 7) {
+		sf::Uint8 byte = *take(1);
+
+		value |= (sf::Uint64)(byte & 0x7f) << shift;
+
+		if (!(byte & 0x80))
+			return value;
+	}
+
+	throw std::runtime_error("invalid variable length integer");
+}
+
+sf::Int64 Reader::ReadZigZag()
 {
+	sf::Uint64 value = ReadVarint();
+
+	return (sf::Int64)(value >> 1) ^ -(sf::Int64)(value & 1);
+}
+
+Data Reader::ReadData(size_t length)
+{
+	return Data(take(length), length, owner);
+}
+
+
+Host::Host()
+{
+	/*
+	 * Slot zero is reserved, as ID zero is used for no ID.
+	 */
+	slots.push_back(Slot{ nullptr, NULL, 0, true });
 }
 
 ID Host::MakeID()
 {
-	ID id(++ids);
+	std::unique_lock<std::shared_mutex> l(lock);
 
-	if (*id == 0)
-		throw std::runtime_error("out of id space");
+	sf::Uint32 index;
 
-	return id;
+	if (!free_slots.empty()) {
+		index = free_slots.back();
+
+		free_slots.pop_back();
+	}
+	else {
+		if (slots.size() > 0xffffffff)
+			throw std::runtime_error("out of id space");
+
+		index = (sf::Uint32)slots.size();
+
+		slots.push_back(Slot{ nullptr, NULL, 0, false });
+	}
+
+	Slot& slot = slots[index];
+
+	slot.used = true;
+
+	return ID(((unsigned long long)slot.generation << 32) | index);
+}
+
+Host::Slot* Host::find_slot(ID id)
+{
+	sf::Uint32 index = (sf::Uint32)*id;
+
+	if (index == 0 || index >= slots.size())
+		return NULL;
+
+	Slot& slot = slots[index];
+
+	if (!slot.used || slot.generation != (sf::Uint32)(*id >> 32))
+		return NULL;
+
+	return &slot;
+}
+
+void Host::release_slot(ID id)
+{
+	Slot* slot = find_slot(id);
+
+	if (!slot || slot->method || slot->_interface)
+		return;
+
+	slot->used = false;
+	slot->generation++;
+
+	free_slots.push_back((sf::Uint32)*id);
 }
 
-ID Host::Register(std::function<std::any(std::vector<std::any>)> handler)
+ID Host::register_entry(std::shared_ptr<const Entry> entry)
 {
 	ID id = MakeID();
 
-	methods[id] = handler;
+	std::unique_lock<std::shared_mutex> l(lock);
+
+	find_slot(id)->method = entry;
 
 	return id;
 }
 
+ID Host::Register(std::function<std::any(std::vector<std::any>)> handler, MethodFlags flags)
+{
+	return register_entry(std::make_shared<const Entry>(Entry{ handler, nullptr, NULL, NULL, flags }));
+}
+
+ID Host::RegisterDecoder(Decoder decoder, MethodFlags flags)
+{
+	return register_entry(std::make_shared<const Entry>(Entry{ nullptr, decoder, NULL, NULL, flags }));
+}
+
+ID Host::RegisterInvoker(Invoker invoker, void* context, MethodFlags flags)
+{
+	return register_entry(std::make_shared<const Entry>(Entry{ nullptr, nullptr, invoker, context, flags }));
+}
+
 void Host::Unregister(ID id)
 {
-	auto it = methods.find(id);
+	std::unique_lock<std::shared_mutex> l(lock);
+
+	Slot* slot = find_slot(id);
 
-	if (it == methods.end())
+	if (!slot || !slot->method)
 		throw std::runtime_error(std::string("invalid method id ") + std::to_string(*id));
 
-	methods.erase(it);
+	slot->method.reset();
+
+	release_slot(id);
 }
 
 void Host::RegisterInterface(ID id, void *_interface)
 {
-	interfaces[id] = _interface;
+	std::unique_lock<std::shared_mutex> l(lock);
+
+	Slot* slot = find_slot(id);
+
+	if (!slot)
+		throw std::runtime_error(std::string("invalid interface id ") + std::to_string(*id));
+
+	slot->_interface = _interface;
 }
 
 void Host::UnregisterInterface(ID id)
 {
-	auto it = interfaces.find(id);
+	std::unique_lock<std::shared_mutex> l(lock);
+
+	Slot* slot = find_slot(id);
 
-	if (it == interfaces.end())
+	if (!slot || !slot->_interface)
 		throw std::runtime_error(std::string("invalid interface id ") + std::to_string(*id));
 
-	interfaces.erase(it);
+	slot->_interface = NULL;
+
+	release_slot(id);
 }
 
 void* Host::LookupInterface(ID id)
 {
-	auto it = interfaces.find(id);
+	std::shared_lock<std::shared_mutex> l(lock);
+
+	Slot* slot = find_slot(id);
 
-	if (it == interfaces.end())
+	if (!slot || !slot->_interface)
 		throw std::runtime_error(std::string("invalid interface id ") + std::to_string(*id));
 
-	return it->second;
+	return slot->_interface;
+}
+
+std::shared_ptr<const Host::Entry> Host::lookup(ID id)
+{
+	std::shared_lock<std::shared_mutex> l(lock);
+
+	Slot* slot = find_slot(id);
+
+	if (!slot || !slot->method)
+		throw std::runtime_error(std::string("invalid method id ") + std::to_string(*id));
+
+	return slot->method;
 }
 
 std::any Host::Handle(ID id, std::vector<std::any> args)
@@ -92,71 +413,110 @@ std::any Host::Handle(ID id, std::vector<std::any> args)
 		LOG_DEBUG("Voodoo::Host::Handle() <-- (%zu) '%s'\n", n, args[n].type().name());
 #endif
 
-	auto it = methods.find(id);
+	/*
+	 * Keep a reference to the method, as the handler may unregister it.
+	 */
+	auto method = lookup(id);
 
-	if (it == methods.end())
-		throw std::runtime_error(std::string("invalid method id ") + std::to_string(*id));
+	if (!method->handler)
+		throw std::runtime_error(std::string("typed method id ") + std::to_string(*id) + " called with dynamic arguments");
+
+	if (method->flags & ONEWAY) {
+		method->handler(args);
+
+		return std::any();
+	}
+
+	return method->handler(args);
+}
+
+void Host::Handle(ID id, Reader& request, sf::Packet* reply)
+{
+	/*
+	 * Keep a reference to the method, as the handler may unregister it.
+	 */
+	auto method = lookup(id);
+
+	if (method->flags & ONEWAY)
+		reply = NULL;
+
+	/*
+	 * Typed methods decode the arguments themselves.
+	 */
+	if (method->invoker) {
+		LOG_DEBUG("Voodoo::Host::Handle([%llu], invoker)\n", *id);
+
+		method->invoker(method->context, request, reply);
+		return;
+	}
+
+	if (method->decoder) {
+		LOG_DEBUG("Voodoo::Host::Handle([%llu], typed)\n", *id);
+
+		method->decoder(request, reply);
+		return;
+	}
+
+	std::vector<std::any> args;
+
+	get_values(request, args);
+
+	LOG_DEBUG("Voodoo::Host::Handle([%llu], %zu args)\n", *id, args.size());
+
+	std::any result = method->handler(args);
 
-	return it->second(args);
+	if (reply && result.has_value())
+		any_to_packet(result, *reply);
 }
 
 void Host::any_to_packet(std::any value, sf::Packet& packet)
 {
 	if (value.type() == typeid(ID)) {
-		packet << Packet::ID;
-		packet << std::any_cast<ID>(value);
+		put_arg(packet, std::any_cast<ID>(value));
 	}
 	else if (value.type() == typeid(char)) {
-		packet << Packet::INT8;
-		packet << std::any_cast<char>(value);
+		put_arg(packet, (sf::Int8)std::any_cast<char>(value));
 	}
 	else if (value.type() == typeid(unsigned char)) {
-		packet << Packet::UINT8;
-		packet << std::any_cast<unsigned char>(value);
+		put_arg(packet, (sf::Uint8)std::any_cast<unsigned char>(value));
 	}
 	else if (value.type() == typeid(short)) {
-		packet << Packet::INT16;
-		packet << std::any_cast<short>(value);
+		put_arg(packet, (sf::Int16)std::any_cast<short>(value));
 	}
 	else if (value.type() == typeid(unsigned short)) {
-		packet << Packet::UINT16;
-		packet << std::any_cast<unsigned short>(value);
+		put_arg(packet, (sf::Uint16)std::any_cast<unsigned short>(value));
 	}
 	else if (value.type() == typeid(int)) {
-		packet << Packet::INT32;
-		packet << std::any_cast<int>(value);
+		put_arg(packet, (sf::Int32)std::any_cast<int>(value));
 	}
 	else if (value.type() == typeid(unsigned int)) {
-		packet << Packet::UINT32;
-		packet << std::any_cast<unsigned int>(value);
+		put_arg(packet, (sf::Uint32)std::any_cast<unsigned int>(value));
 	}
 	else if (value.type() == typeid(long long)) {
-		packet << Packet::INT64;
-		packet << std::any_cast<long long>(value);
+		put_arg(packet, (sf::Int64)std::any_cast<long long>(value));
 	}
 	else if (value.type() == typeid(unsigned long long)) {
-		packet << Packet::UINT64;
-		packet << std::any_cast<unsigned long long>(value);
+		put_arg(packet, (sf::Uint64)std::any_cast<unsigned long long>(value));
 	}
 	else if (value.type() == typeid(float)) {
-		packet << Packet::FLOAT32;
-		packet << std::any_cast<float>(value);
+		put_arg(packet, std::any_cast<float>(value));
 	}
 	else if (value.type() == typeid(double)) {
-		packet << Packet::FLOAT64;
-		packet << std::any_cast<double>(value);
+		put_arg(packet, std::any_cast<double>(value));
 	}
 	else if (value.type() == typeid(std::string)) {
-		packet << Packet::STRING;
-		packet << std::any_cast<std::string>(value);
+		put_arg(packet, std::any_cast<std::string>(value));
 	}
 	else if (value.type() == typeid(const char*)) {
-		packet << Packet::STRING;
-		packet << std::any_cast<const char*>(value);
+		put_arg(packet, std::string(std::any_cast<const char*>(value)));
 	}
 	else if (value.type() == typeid(std::pair<const void*, size_t>)) {
-		packet << Packet::DATA;
-		packet.append(std::any_cast<std::pair<const void*, size_t>>(value).first, std::any_cast<std::pair<const void*, size_t>>(value).second);
+		auto data = std::any_cast<std::pair<const void*, size_t>>(value);
+
+		put_arg(packet, Data(data.first, data.second));
+	}
+	else if (value.type() == typeid(Data)) {
+		put_arg(packet, std::any_cast<Data>(value));
 	}
 	else if (value.type() == typeid(std::vector<std::any>)) {
 		auto values = std::any_cast<std::vector<std::any>>(value);
@@ -168,94 +528,65 @@ void Host::any_to_packet(std::any value, sf::Packet& packet)
 		throw std::runtime_error("unknown/unimplemented type");
 }
 
-void Host::get_values(sf::Packet& packet, std::vector<std::any>& values, size_t readStart)
+void Host::get_values(Reader& reader, std::vector<std::any>& values)
 {
-	size_t readPosition = readStart;
-
-	while (!packet.endOfPacket()) {
-		int t;
-		ID id;
+	while (!reader.EndOfData()) {
+		sf::Uint8 t;
 		sf::Int8 i8;
 		sf::Uint8 u8;
-		sf::Int16 i16;
-		sf::Uint16 u16;
-		sf::Int32 i32;
-		sf::Uint32 u32;
-		sf::Int64 i64;
-		sf::Uint64 u64;
 		float f32;
 		double f64;
-		std::string str;
-		const void* ptr;
+		Data data;
 
-		packet >> t;
-		readPosition += sizeof(t);
+		reader >> t;
 
 		switch (t) {
 		case Packet::ID:
-			packet >> id;
-			readPosition += sizeof(id);
-			values.push_back(id);
+			values.push_back(ID(reader.ReadVarint()));
 			break;
 		case Packet::INT8:
-			packet >> i8;
-			readPosition += sizeof(i8);
+			reader >> i8;
 			values.push_back(i8);
 			break;
 		case Packet::UINT8:
-			packet >> u8;
-			readPosition += sizeof(u8);
+			reader >> u8;
 			values.push_back(u8);
 			break;
 		case Packet::INT16:
-			packet >> i16;
-			readPosition += sizeof(i16);
-			values.push_back(i16);
+			values.push_back(narrow_integer<sf::Int16>(reader.ReadZigZag()));
 			break;
 		case Packet::UINT16:
-			packet >> u16;
-			readPosition += sizeof(u16);
-			values.push_back(u16);
+			values.push_back(narrow_integer<sf::Uint16>(reader.ReadVarint()));
 			break;
 		case Packet::INT32:
-			packet >> i32;
-			readPosition += sizeof(i32);
-			values.push_back(i32);
+			values.push_back(narrow_integer<sf::Int32>(reader.ReadZigZag()));
 			break;
 		case Packet::UINT32:
-			packet >> u32;
-			readPosition += sizeof(u32);
-			values.push_back(u32);
+			values.push_back(narrow_integer<sf::Uint32>(reader.ReadVarint()));
 			break;
 		case Packet::INT64:
-			packet >> i64;
-			readPosition += sizeof(i64);
-			values.push_back(i64);
+			values.push_back(reader.ReadZigZag());
 			break;
 		case Packet::UINT64:
-			packet >> u64;
-			readPosition += sizeof(u64);
-			values.push_back(u64);
+			values.push_back(reader.ReadVarint());
 			break;
 		case Packet::FLOAT32:
-			packet >> f32;
-			readPosition += sizeof(f32);
+			reader >> f32;
 			values.push_back(f32);
 			break;
 		case Packet::FLOAT64:
-			packet >> f64;
-			readPosition += sizeof(f64);
+			reader >> f64;
 			values.push_back(f64);
 			break;
 		case Packet::STRING:
-			packet >> str;
-			readPosition += str.size() + 1;
-			values.push_back(str);
+			data = reader.ReadData(reader.ReadVarint());
+			values.push_back(std::string((const char*)data.data(), data.size()));
 			break;
 		case Packet::DATA:
-			ptr = (const char*)packet.getData() + readPosition;
-			values.push_back(ptr);
-			return;
+			values.push_back(reader.ReadData(reader.ReadVarint()));
+			break;
+		case Packet::UNTAGGED:
+			throw std::runtime_error("values without types, method has to be typed");
 		default:
 			throw std::runtime_error("unknown/unimplemented type");
 		}
@@ -263,194 +594,2946 @@ void Host::get_values(sf::Packet& packet, std::vector<std::any>& values, size_t
 }
 
 
-thread_local sf::TcpSocket* Server::current_client;
-
-Server::Server()
+CommandBuffer::CommandBuffer()
 	:
-	running(false),
-	acceptor(0)
+	count(0)
 {
 }
 
-Server::~Server() noexcept(false)
+void CommandBuffer::Clear()
 {
-	std::unique_lock<std::mutex> l(lock);
-
-	if (running)
-		throw std::runtime_error("server not stopped before destruction");
+	buffer.clear();
 
-	int localPort = listener.getLocalPort();
+	count = 0;
+}
 
-	if (localPort) {
-		listener.close();
+bool CommandBuffer::Empty() const
+{
+	return count == 0;
+}
 
-		/*
-		 * On Linux this is required to interrupt the blocking accept() call.
-		 * 
-		 * TODO: Replace hack by using non-blocking listener socket.
-		 */
-		sf::TcpSocket* hack = new sf::TcpSocket();
-		hack->connect("127.0.0.1", localPort);
-		delete hack;
-	}
+size_t CommandBuffer::GetCount() const
+{
+	return count;
+}
 
-	l.unlock();
+const void* CommandBuffer::GetData() const
+{
+	return buffer.getData();
+}
 
-	if (acceptor) {
-		acceptor->join();
+size_t CommandBuffer::GetSize() const
+{
+	return buffer.getDataSize();
+}
 
-		delete acceptor;
-	}
+void CommandBuffer::Execute(const void* data, size_t size, std::function<void(std::vector<std::any>)> handler)
+{
+	split(data, size, [&handler](Reader& command) {
+			std::vector<std::any> values;
 
-	//??	l.lock();
+			Host::get_values(command, values);
 
-	for (auto socket : clients)
-		delete socket;
+			handler(values);
+		});
 }
 
-void Server::Listen(int port)
+void CommandBuffer::Execute(const void* data, size_t size, std::function<void(int method, Reader& command)> handler)
 {
-	if (acceptor)
-		throw std::runtime_error("server already listening");
-
-	if (listener.listen(port) != sf::Socket::Done)
-		throw std::runtime_error("could not listen");
-
-	running = true;
+	split(data, size, [&handler](Reader& command) {
+			int method;
 
-	acceptor = new std::thread([this] () {
-			std::unique_lock<std::mutex> l(lock);
+			Host::get_arg(command, method);
 
-			while (running) {
-				l.unlock();
+			handler(method, command);
+		});
+}
 
-				sf::TcpSocket *socket = new sf::TcpSocket();
+void CommandBuffer::split(const void* data, size_t size, std::function<void(Reader& command)> handler)
+{
+	Reader buffer(data, size);
 
-				if (listener.accept(*socket) == sf::Socket::Done) {
-					l.lock();
+	while (!buffer.EndOfData()) {
+		sf::Uint64 command_size = buffer.ReadVarint();
 
-					clients.push_back(socket);
+		/*
+		 * Data values of the command point into the submitted buffer, being valid while the handler runs.
+		 */
+		Data command = buffer.ReadData(command_size);
 
-					selector.add(*socket);
-				}
-				else {
-					delete socket;
+		Reader reader(command.data(), command.size());
 
-					l.lock();
-				}
-			}
-		});
+		handler(reader);
+	}
 }
 
-void Server::Run()
+void CommandBuffer::append(sf::Packet& command)
 {
-	std::unique_lock<std::mutex> l(lock);
+	put_varint(buffer, command.getDataSize());
+	buffer.append(command.getData(), command.getDataSize());
 
-	while (running) {
-		l.unlock();
+	count++;
+}
 
-		if (selector.wait(sf::milliseconds(50))) {
-			l.lock();
 
-			for (auto it = clients.begin(); it != clients.end(); it++) {
-				auto socket = *it;
+/*
+ * Access to the native handle, as sf::Socket::getHandle() is protected.
+ */
+class NativeHandle : public sf::Socket
+{
+public:
+	static sf::SocketHandle Get(sf::Socket& socket)
+	{
+		return (socket.*(&NativeHandle::getHandle))();
+	}
+};
 
-				if (selector.isReady(*socket)) {
-					sf::Packet request, reply;
 
-					switch (socket->receive(request)) {
-					case sf::Socket::Done:
-						current_client = socket;
+#ifdef __linux__
 
-						dispatch(request, reply);
+Reactor::Reactor()
+	:
+	batch(NULL)
+{
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
 
-						current_client = NULL;
+	if (epoll_fd < 0)
+		throw std::runtime_error("could not create epoll instance");
 
-						socket->send(reply);
-						break;
+	event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
 
-					default:
-						cleanup(socket);
+	if (event_fd < 0) {
+		::close(epoll_fd);
 
-						clients.erase(it);
-						selector.remove(*socket);
-						break;
-					}
-				}
-			}
+		throw std::runtime_error("could not create eventfd");
+	}
 
-			l.unlock();
-		}
+	epoll_event ev = {};
 
-		l.lock();
-	}
+	ev.events = EPOLLIN;
+	ev.data.ptr = this;
+
+	epoll_ctl(epoll_fd, EPOLL_CTL_ADD, event_fd, &ev);
 }
 
-void Server::Stop()
+Reactor::~Reactor()
 {
-	std::unique_lock<std::mutex> l(lock);
-
-	running = false;
+	::close(event_fd);
+	::close(epoll_fd);
 }
 
-void Server::PushCleanup(Voodoo::ID cleanup_id, CleanupHandler handler)
+void Reactor::Add(sf::Socket& socket, void* context, int events)
 {
-	if (!current_client)
-		throw std::runtime_error("no current client");
-
-	cleanups[current_client].insert(std::make_pair(cleanup_id, handler));
+	Add(NativeHandle::Get(socket), context, events);
 }
 
-void Server::RemoveCleanup(Voodoo::ID cleanup_id)
+void Reactor::Modify(sf::Socket& socket, void* context, int events)
 {
-	if (!current_client)
-		throw std::runtime_error("no current client");
+	Modify(NativeHandle::Get(socket), context, events);
+}
 
-	cleanups[current_client].erase(cleanup_id);
+void Reactor::Remove(sf::Socket& socket, void* context)
+{
+	Remove(NativeHandle::Get(socket), context);
 }
 
-void Server::cleanup(sf::TcpSocket* socket)
+/*
+ * Convert Reactor::Events to epoll events.
+ */
+static uint32_t epoll_events(int events)
 {
-	auto it = cleanups.find(socket);
+	uint32_t mask = 0;
 
-	if (it != cleanups.end()) {
-		for (auto it2 = it->second.rbegin(); it2 != it->second.rend(); it2++)
-			it2->second();
+	if (events & Reactor::READ)
+		mask |= EPOLLIN;
 
-		cleanups.erase(it);
-	}
+	if (events & Reactor::WRITE)
+		mask |= EPOLLOUT;
+
+	if (events & Reactor::HANGUP)
+		mask |= EPOLLRDHUP;
+
+	return mask;
 }
 
-void Server::dispatch(sf::Packet& request, sf::Packet &reply)
+void Reactor::Add(int fd, void* context, int events)
 {
-	ID method_id;
+	epoll_event ev = {};
 
-	if (request >> method_id) {
-		LOG_DEBUG("Voodoo::Server::dispatch(%zu, [%llu])\n",
-				  request.getDataSize(), *method_id);
+	ev.events = epoll_events(events);
+	ev.data.ptr = context;
 
-		std::vector<std::any> args;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0)
+		throw std::runtime_error("could not add socket to epoll instance");
+}
 
-		get_values(request, args, sizeof(ID));
+void Reactor::Modify(int fd, void* context, int events)
+{
+	epoll_event ev = {};
 
-		std::any result = Handle(method_id, args);
+	ev.events = epoll_events(events);
+	ev.data.ptr = context;
 
-		any_to_packet(result, reply);
-	}
+	epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev);
 }
 
-
-Client::Client()
+void Reactor::Remove(int fd, void* context)
 {
+	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+
+	if (batch) {
+		for (auto& event : *batch) {
+			if (event.context == context)
+				event.context = NULL;
+		}
+	}
 }
 
-void Client::Connect(std::string host, int port)
+void Reactor::Wait(std::vector<Event>& events, int timeout_ms)
 {
-	if (socket.getRemotePort() != 0)
+	epoll_event evs[64];
+
+	events.clear();
+
+	batch = &events;
+
+	int num = epoll_wait(epoll_fd, evs, 64, timeout_ms);
+
+	for (int i = 0; i < num; i++) {
+		if (evs[i].data.ptr == this) {
+			eventfd_t value;
+
+			eventfd_read(event_fd, &value);
+			continue;
+		}
+
+		/*
+		 * Errors and hangups are reported as readable, the following receive() fails.
+		 */
+		int ready = 0;
+
+		if (evs[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+			ready |= READ;
+
+		if (evs[i].events & EPOLLOUT)
+			ready |= WRITE;
+
+		if (evs[i].events & (EPOLLRDHUP | EPOLLHUP))
+			ready |= HANGUP;
+
+		events.push_back(Event{ evs[i].data.ptr, ready });
+	}
+}
+
+void Reactor::Wake()
+{
+	eventfd_write(event_fd, 1);
+}
+
+#else
+
+Reactor::Reactor()
+{
+}
+
+Reactor::~Reactor()
+{
+}
+
+void Reactor::Add(sf::Socket& socket, void* context, int events)
+{
+	std::unique_lock<std::mutex> l(lock);
+
+	sources[context] = Source{ &socket, events };
+
+	if (sf::TcpListener* listener = dynamic_cast<sf::TcpListener*>(&socket))
+		selector.add(*listener);
+	else
+		selector.add(*dynamic_cast<sf::TcpSocket*>(&socket));
+}
+
+void Reactor::Modify(sf::Socket& socket, void* context, int events)
+{
+	std::unique_lock<std::mutex> l(lock);
+
+	auto it = sources.find(context);
+
+	if (it != sources.end())
+		it->second.events = events;
+}
+
+void Reactor::Remove(sf::Socket& socket, void* context)
+{
+	std::unique_lock<std::mutex> l(lock);
+
+	sources.erase(context);
+
+	if (sf::TcpListener* listener = dynamic_cast<sf::TcpListener*>(&socket))
+		selector.remove(*listener);
+	else
+		selector.remove(*dynamic_cast<sf::TcpSocket*>(&socket));
+}
+
+void Reactor::Wait(std::vector<Event>& events, int timeout_ms)
+{
+	events.clear();
+
+	/*
+	 * The selector can not be woken up, so Wake() takes effect after the timeout.
+	 */
+	if (timeout_ms < 0 || timeout_ms > 50)
+		timeout_ms = 50;
+
+	bool readable = selector.wait(sf::milliseconds(std::max(timeout_ms, 1)));
+
+	std::unique_lock<std::mutex> l(lock);
+
+	for (auto& source : sources) {
+		int ready = 0;
+
+		if (readable && (source.second.events & READ)) {
+			if (sf::TcpListener* listener = dynamic_cast<sf::TcpListener*>(source.second.socket)) {
+				if (selector.isReady(*listener))
+					ready |= READ;
+			}
+			else if (selector.isReady(*dynamic_cast<sf::TcpSocket*>(source.second.socket)))
+				ready |= READ;
+		}
+
+		/*
+		 * Write readiness is not available, pending writes are retried.
+		 */
+		if (source.second.events & WRITE)
+			ready |= WRITE;
+
+		if (ready)
+			events.push_back(Event{ source.first, ready });
+	}
+}
+
+void Reactor::Wake()
+{
+}
+
+#endif
+
+
+void Channel::Watch(Reactor& reactor, void* context)
+{
+	this->reactor = &reactor;
+	this->context = context;
+}
+
+sf::Socket::Status Channel::Prepare(int)
+{
+	return sf::Socket::Done;
+}
+
+void Channel::WaitWritable(bool)
+{
+}
+
+void Channel::Shutdown()
+{
+}
+
+
+void Listener::Watch(Reactor& reactor, void* context)
+{
+	this->reactor = &reactor;
+	this->context = context;
+}
+
+
+#ifndef _WIN32
+
+/*
+ * Send request followed by the data buffers as DATA values on a blocking socket.
+ *
+ * Same framing as sf::Packet (size in network byte order), but without copying the buffers.
+ */
+static void send_message(int fd, const sf::Packet& request, const std::vector<Data>& blobs)
+{
+	/*
+	 * Type and length of each data buffer, the offsets mark where each one ends.
+	 */
+	sf::Packet prefixes;
+	std::vector<size_t> offsets;
+
+	offsets.reserve(blobs.size() + 1);
+	offsets.push_back(0);
+
+	size_t total = request.getDataSize();
+
+	for (auto& blob : blobs) {
+		put_data_prefix(prefixes, blob.size());
+
+		offsets.push_back(prefixes.getDataSize());
+
+		total += blob.size();
+	}
+
+	total += prefixes.getDataSize();
+
+	if (total > 0xffffffff)
+		throw std::runtime_error("request too large");
+
+	sf::Uint32 size = htonl((sf::Uint32)total);
+
+	std::vector<struct iovec> iov(2 + 2 * blobs.size());
+
+	iov[0].iov_base = &size;
+	iov[0].iov_len = sizeof(size);
+	iov[1].iov_base = (void*)request.getData();
+	iov[1].iov_len = request.getDataSize();
+
+	for (size_t i = 0; i < blobs.size(); i++) {
+		iov[2 + 2 * i].iov_base = (char*)prefixes.getData() + offsets[i];
+		iov[2 + 2 * i].iov_len = offsets[i + 1] - offsets[i];
+		iov[3 + 2 * i].iov_base = (void*)blobs[i].data();
+		iov[3 + 2 * i].iov_len = blobs[i].size();
+	}
+
+	int flags = 0;
+#ifdef MSG_NOSIGNAL
+	flags |= MSG_NOSIGNAL;
+#endif
+
+	struct iovec* next = iov.data();
+	size_t remaining = iov.size();
+
+	while (remaining) {
+		struct msghdr msg = {};
+
+		msg.msg_iov = next;
+		msg.msg_iovlen = std::min(remaining, (size_t)IOV_MAX);
+
+		ssize_t sent = sendmsg(fd, &msg, flags);
+
+		if (sent < 0) {
+			if (errno == EINTR)
+				continue;
+
+			throw std::runtime_error("could not send request");
+		}
+
+		/*
+		 * Skip what has been sent in case of a partial write.
+		 */
+		while (remaining && (size_t)sent >= next->iov_len) {
+			sent -= next->iov_len;
+
+			next++;
+			remaining--;
+		}
+
+		if (remaining) {
+			next->iov_base = (char*)next->iov_base + sent;
+			next->iov_len -= sent;
+		}
+	}
+}
+
+/*
+ * Send head and body as one packet on a non-blocking socket, continuing a partial send at the offset.
+ */
+static sf::Socket::Status send_packet(int fd, const sf::Packet& head, const sf::Packet* body, size_t& send_offset)
+{
+	size_t body_size = body ? body->getDataSize() : 0;
+
+	sf::Uint32 size = htonl((sf::Uint32)(head.getDataSize() + body_size));
+
+	size_t total = sizeof(size) + head.getDataSize() + body_size;
+
+	int flags = MSG_DONTWAIT;
+#ifdef MSG_NOSIGNAL
+	flags |= MSG_NOSIGNAL;
+#endif
+
+	while (send_offset < total) {
+		struct iovec iov[3];
+
+		iov[0].iov_base = &size;
+		iov[0].iov_len = sizeof(size);
+		iov[1].iov_base = (void*)head.getData();
+		iov[1].iov_len = head.getDataSize();
+		iov[2].iov_base = body ? (void*)body->getData() : NULL;
+		iov[2].iov_len = body_size;
+
+		/*
+		 * Skip what has been sent before.
+		 */
+		struct iovec* next = iov;
+		size_t skip = send_offset;
+
+		while (skip >= next->iov_len) {
+			skip -= next->iov_len;
+			next++;
+		}
+
+		next->iov_base = (char*)next->iov_base + skip;
+		next->iov_len -= skip;
+
+		struct msghdr msg = {};
+
+		msg.msg_iov = next;
+		msg.msg_iovlen = iov + 3 - next;
+
+		ssize_t sent = sendmsg(fd, &msg, flags);
+
+		if (sent < 0) {
+			if (errno == EINTR)
+				continue;
+
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return send_offset ? sf::Socket::Partial : sf::Socket::NotReady;
+
+			send_offset = 0;
+
+			return sf::Socket::Error;
+		}
+
+		send_offset += sent;
+	}
+
+	send_offset = 0;
+
+	return sf::Socket::Done;
+}
+
+#endif
+
+
+std::unique_ptr<TcpChannel> TcpChannel::Connect(std::string host, int port)
+{
+	auto channel = std::make_unique<TcpChannel>();
+
+	if (channel->socket.connect(host, port) != sf::Socket::Done)
+		throw std::runtime_error("could not connect");
+
+	channel->selector = std::make_unique<sf::SocketSelector>();
+
+	channel->selector->add(channel->socket);
+
+	return channel;
+}
+
+void TcpChannel::Watch(Reactor& reactor, void* context)
+{
+	Channel::Watch(reactor, context);
+
+	reactor.Add(socket, context, Reactor::READ);
+}
+
+void TcpChannel::Unwatch()
+{
+	reactor->Remove(socket, context);
+}
+
+sf::Socket::Status TcpChannel::Receive(std::unique_ptr<sf::Packet>& packet, int timeout_ms)
+{
+	if (timeout_ms && !selector->wait(sf::milliseconds(timeout_ms)))
+		return sf::Socket::NotReady;
+
+	packet = std::make_unique<sf::Packet>();
+
+	sf::Socket::Status status = socket.receive(*packet);
+
+	if (status != sf::Socket::Done)
+		packet.reset();
+
+	return status;
+}
+
+sf::Socket::Status TcpChannel::Send(const sf::Packet& head, const sf::Packet* body)
+{
+#ifdef _WIN32
+	if (!send_offset) {
+		sending.clear();
+		sending.append(head.getData(), head.getDataSize());
+
+		if (body)
+			sending.append(body->getData(), body->getDataSize());
+
+		send_offset = 1;	// sending is in progress
+	}
+
+	sf::Socket::Status status = socket.send(sending);
+
+	if (status != sf::Socket::NotReady && status != sf::Socket::Partial)
+		send_offset = 0;
+
+	return status;
+#else
+	return send_packet(NativeHandle::Get(socket), head, body, send_offset);
+#endif
+}
+
+void TcpChannel::WaitWritable(bool enable)
+{
+	reactor->Modify(socket, context, enable ? Reactor::READ | Reactor::WRITE : Reactor::READ);
+}
+
+void TcpChannel::Shutdown()
+{
+	/*
+	 * Without a native shutdown, the server notices when retrying the pending writes.
+	 */
+#ifndef _WIN32
+	::shutdown(NativeHandle::Get(socket), SHUT_RDWR);
+#endif
+}
+
+void TcpChannel::Send(sf::Packet& request, const std::vector<Data>& blobs)
+{
+	if (blobs.empty()) {
+		if (socket.send(request) != sf::Socket::Done)
+			throw std::runtime_error("could not send request");
+
+		return;
+	}
+
+#ifdef _WIN32
+	sf::Packet message;
+
+	message.append(request.getData(), request.getDataSize());
+
+	for (auto& blob : blobs) {
+		put_data_prefix(message, blob.size());
+
+		message.append(blob.data(), blob.size());
+	}
+
+	if (socket.send(message) != sf::Socket::Done)
+		throw std::runtime_error("could not send request");
+#else
+	send_message(NativeHandle::Get(socket), request, blobs);
+#endif
+}
+
+
+TcpListener::TcpListener(int port)
+{
+	if (listener.listen(port) != sf::Socket::Done)
+		throw std::runtime_error("could not listen");
+
+	listener.setBlocking(false);
+}
+
+void TcpListener::Watch(Reactor& reactor, void* context)
+{
+	Listener::Watch(reactor, context);
+
+	reactor.Add(listener, context, Reactor::READ);
+}
+
+void TcpListener::Enable(bool enable)
+{
+	reactor->Modify(listener, context, enable ? Reactor::READ : 0);
+}
+
+std::unique_ptr<Channel> TcpListener::Accept()
+{
+	auto channel = std::make_unique<TcpChannel>();
+
+	switch (listener.accept(channel->socket)) {
+	case sf::Socket::Done:
+		break;
+
+	case sf::Socket::NotReady:
+		return nullptr;
+
+	default:
+		throw std::runtime_error("could not accept");
+	}
+
+	channel->socket.setBlocking(false);
+
+	return channel;
+}
+
+
+#ifdef __linux__
+
+/*
+ * Address of a Unix domain socket, names starting with '@' are in the abstract namespace.
+ */
+static socklen_t unix_address(const std::string& path, sockaddr_un& address)
+{
+	memset(&address, 0, sizeof(address));
+
+	address.sun_family = AF_UNIX;
+
+	if (path.size() >= sizeof(address.sun_path))
+		throw std::runtime_error("socket path too long");
+
+	memcpy(address.sun_path, path.data(), path.size());
+
+	if (path[0] == '@')
+		address.sun_path[0] = 0;
+
+	return offsetof(sockaddr_un, sun_path) + path.size();
+}
+
+/*
+ * Create non-blocking Unix domain socket listening on the path.
+ */
+static int unix_listen(const std::string& path)
+{
+	sockaddr_un address;
+
+	socklen_t length = unix_address(path, address);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+	if (fd < 0 ||
+		bind(fd, (sockaddr*)&address, length) < 0 ||
+		::listen(fd, SOMAXCONN) < 0) {
+		if (fd >= 0)
+			::close(fd);
+
+		throw std::runtime_error("could not listen");
+	}
+
+	return fd;
+}
+
+/*
+ * Create blocking Unix domain socket connected to the path.
+ */
+static int unix_connect(const std::string& path)
+{
+	sockaddr_un address;
+
+	socklen_t length = unix_address(path, address);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+	if (fd < 0)
+		throw std::runtime_error("could not create socket");
+
+	if (::connect(fd, (sockaddr*)&address, length) < 0) {
+		::close(fd);
+
+		throw std::runtime_error("could not connect");
+	}
+
+	return fd;
+}
+
+/*
+ * Accept connection as a non-blocking socket, -1 if none is pending.
+ */
+static int unix_accept(int listen_fd)
+{
+	int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+	if (fd < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR || errno == ECONNABORTED)
+			return -1;
+
+		throw std::runtime_error("could not accept");
+	}
+
+	return fd;
+}
+
+
+UnixChannel::UnixChannel(int fd)
+	:
+	fd(fd),
+	received(0),
+	consumed(0),
+	send_offset(0)
+{
+}
+
+UnixChannel::~UnixChannel()
+{
+	::close(fd);
+}
+
+std::unique_ptr<UnixChannel> UnixChannel::Connect(std::string path)
+{
+	return std::make_unique<UnixChannel>(unix_connect(path));
+}
+
+void UnixChannel::Watch(Reactor& reactor, void* context)
+{
+	Channel::Watch(reactor, context);
+
+	reactor.Add(fd, context, Reactor::READ);
+}
+
+void UnixChannel::Unwatch()
+{
+	reactor->Remove(fd, context);
+}
+
+sf::Socket::Status UnixChannel::Receive(std::unique_ptr<sf::Packet>& packet, int timeout_ms)
+{
+	while (true) {
+		/*
+		 * Return complete packet from the buffer.
+		 */
+		size_t available = received - consumed;
+		size_t needed = sizeof(sf::Uint32);
+
+		if (available >= sizeof(sf::Uint32)) {
+			sf::Uint32 size;
+
+			memcpy(&size, buffer.data() + consumed, sizeof(size));
+
+			if (ntohl(size) > MAX_PACKET_SIZE)
+				return sf::Socket::Error;
+
+			needed += ntohl(size);
+
+			if (available >= needed) {
+				packet = std::make_unique<sf::Packet>();
+
+				packet->append(buffer.data() + consumed + sizeof(size), needed - sizeof(size));
+
+				consumed += needed;
+
+				return sf::Socket::Done;
+			}
+		}
+
+		/*
+		 * Move the partial packet to the front.
+		 */
+		if (consumed) {
+			memmove(buffer.data(), buffer.data() + consumed, available);
+
+			received = available;
+			consumed = 0;
+		}
+
+		/*
+		 * The buffer grows with the bytes received, not with the size announced by the peer.
+		 */
+		buffer.resize(std::max(buffer.size(), std::min(needed, std::max(2 * received, (size_t)0x1000))));
+
+		ssize_t length = recv(fd, buffer.data() + received, buffer.size() - received, MSG_DONTWAIT);
+
+		if (length > 0) {
+			received += length;
+			continue;
+		}
+
+		if (length == 0)
+			return sf::Socket::Disconnected;
+
+		if (errno == EINTR)
+			continue;
+
+		if (errno != EAGAIN && errno != EWOULDBLOCK)
+			return sf::Socket::Error;
+
+		if (!timeout_ms) {
+			/*
+			 * No allocations are kept while idle.
+			 */
+			if (!received)
+				std::vector<sf::Uint8>().swap(buffer);
+
+			return sf::Socket::NotReady;
+		}
+
+		struct pollfd ready = { fd, POLLIN, 0 };
+
+		if (poll(&ready, 1, timeout_ms) <= 0)
+			return sf::Socket::NotReady;
+
+		timeout_ms = 0;
+	}
+}
+
+sf::Socket::Status UnixChannel::Send(const sf::Packet& head, const sf::Packet* body)
+{
+	return send_packet(fd, head, body, send_offset);
+}
+
+void UnixChannel::WaitWritable(bool enable)
+{
+	reactor->Modify(fd, context, enable ? Reactor::READ | Reactor::WRITE : Reactor::READ);
+}
+
+void UnixChannel::Shutdown()
+{
+	::shutdown(fd, SHUT_RDWR);
+}
+
+void UnixChannel::Send(sf::Packet& request, const std::vector<Data>& blobs)
+{
+	send_message(fd, request, blobs);
+}
+
+
+UnixListener::UnixListener(std::string path)
+	:
+	path(path)
+{
+	if (path.empty())
+		throw std::runtime_error("invalid socket path");
+
+	if (path[0] != '@')
+		unlink(path.c_str());
+
+	fd = unix_listen(path);
+}
+
+UnixListener::~UnixListener()
+{
+	::close(fd);
+
+	if (path[0] != '@')
+		unlink(path.c_str());
+}
+
+void UnixListener::Watch(Reactor& reactor, void* context)
+{
+	Listener::Watch(reactor, context);
+
+	reactor.Add(fd, context, Reactor::READ);
+}
+
+void UnixListener::Enable(bool enable)
+{
+	reactor->Modify(fd, context, enable ? Reactor::READ : 0);
+}
+
+std::unique_ptr<Channel> UnixListener::Accept()
+{
+	int channel_fd = unix_accept(fd);
+
+	if (channel_fd < 0)
+		return nullptr;
+
+	return std::make_unique<UnixChannel>(channel_fd);
+}
+
+
+/*
+ * Name of the abstract Unix domain socket for shared memory connections.
+ */
+static std::string shared_path(int port)
+{
+	return "@voodoo-" + std::to_string(port);
+}
+
+/*
+ * Sleep while the word in shared memory has the value, returns false on timeout.
+ */
+static bool futex_wait(std::atomic<sf::Uint32>* word, sf::Uint32 value, int timeout_ms)
+{
+	struct timespec timeout = { timeout_ms / 1000, (timeout_ms % 1000) * 1000000L };
+
+	return syscall(SYS_futex, (sf::Uint32*)word, FUTEX_WAIT, value, &timeout, NULL, 0) == 0 || errno != ETIMEDOUT;
+}
+
+static void futex_wake(std::atomic<sf::Uint32>* word)
+{
+	syscall(SYS_futex, (sf::Uint32*)word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+
+size_t SharedChannel::Ring::Space()
+{
+	sf::Uint64 used = position - header->tail.load(std::memory_order_acquire);
+
+	if (used > capacity)
+		throw std::runtime_error("shared ring corrupted");
+
+	return capacity - used;
+}
+
+size_t SharedChannel::Ring::Write(const void* ptr, size_t size)
+{
+	size = std::min(size, Space());
+
+	size_t offset = position & (capacity - 1);
+	size_t first = std::min(size, capacity - offset);
+
+	memcpy(data + offset, ptr, first);
+	memcpy(data, (const sf::Uint8*)ptr + first, size - first);
+
+	position += size;
+
+	/*
+	 * Sequentially consistent, so either the reader sees the data or we see it waiting.
+	 */
+	header->head.store(position);
+
+	return size;
+}
+
+size_t SharedChannel::Ring::Readable(const sf::Uint8** ptr)
+{
+	sf::Uint64 available = header->head.load(std::memory_order_acquire) - position;
+
+	if (available > capacity)
+		throw std::runtime_error("shared ring corrupted");
+
+	size_t offset = position & (capacity - 1);
+
+	*ptr = data + offset;
+
+	return std::min((size_t)available, capacity - offset);
+}
+
+void SharedChannel::Ring::Consume(size_t size)
+{
+	position += size;
+
+	header->tail.store(position);
+}
+
+void SharedChannel::Ring::WakeReader()
+{
+	if (!header->reader_waiting.load() || !header->reader_waiting.exchange(0))
+		return;
+
+	if (reader_event >= 0)
+		eventfd_write(reader_event, 1);
+	else
+		futex_wake(&header->reader_waiting);
+}
+
+void SharedChannel::Ring::WakeWriter()
+{
+	if (!header->writer_waiting.load() || !header->writer_waiting.exchange(0))
+		return;
+
+	if (writer_event >= 0)
+		eventfd_write(writer_event, 1);
+	else
+		futex_wake(&header->writer_waiting);
+}
+
+
+SharedChannel::SharedChannel(int socket_fd)
+	:
+	socket_fd(socket_fd),
+	event_fd(-1),
+	memory(NULL),
+	memory_size(0),
+	input(),
+	output(),
+	send_offset(0),
+	size_received(0)
+{
+}
+
+SharedChannel::~SharedChannel()
+{
+	if (memory)
+		munmap(memory, memory_size);
+
+	if (event_fd >= 0)
+		::close(event_fd);
+
+	::close(socket_fd);
+}
+
+std::unique_ptr<SharedChannel> SharedChannel::Connect(int port, size_t ring_size)
+{
+	if (ring_size < 4096 || ring_size > (1u << 30) || (ring_size & (ring_size - 1)))
+		throw std::runtime_error("invalid ring size");
+
+	int fd = unix_connect(shared_path(port));
+
+	auto channel = std::make_unique<SharedChannel>(fd);
+
+	/*
+	 * Sealed against resizing, so the server can not be crashed by truncating the memory.
+	 */
+	int memory_fd = memfd_create("voodoo", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+
+	if (memory_fd < 0)
+		throw std::runtime_error("could not create shared memory");
+
+	try {
+		if (ftruncate(memory_fd, 2 * sizeof(Header) + 2 * ring_size) < 0 ||
+			fcntl(memory_fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0)
+			throw std::runtime_error("could not create shared memory");
+
+		channel->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+		if (channel->event_fd < 0)
+			throw std::runtime_error("could not create eventfd");
+
+		channel->map(memory_fd, ring_size, false);
+
+		/*
+		 * Pass memory and eventfd along with the ring size.
+		 */
+		sf::Uint32 size = (sf::Uint32)ring_size;
+		int fds[2] = { memory_fd, channel->event_fd };
+
+		struct iovec iov = { &size, sizeof(size) };
+		char control[CMSG_SPACE(sizeof(fds))] = {};
+
+		struct msghdr msg = {};
+
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+
+		memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+		if (sendmsg(fd, &msg, MSG_NOSIGNAL) != sizeof(size))
+			throw std::runtime_error("could not connect");
+	}
+	catch (...) {
+		::close(memory_fd);
+		throw;
+	}
+
+	/*
+	 * The mapping stays valid.
+	 */
+	::close(memory_fd);
+
+	return channel;
+}
+
+void SharedChannel::Watch(Reactor& reactor, void* context)
+{
+	Channel::Watch(reactor, context);
+
+	/*
+	 * Readable once the client sent the shared memory.
+	 */
+	reactor.Add(socket_fd, context, Reactor::READ | Reactor::HANGUP);
+}
+
+void SharedChannel::Unwatch()
+{
+	reactor->Remove(socket_fd, context);
+
+	if (memory)
+		reactor->Remove(event_fd, context);
+}
+
+sf::Socket::Status SharedChannel::Prepare(int)
+{
+	try {
+		if (!memory) {
+			if (!attach())
+				return sf::Socket::NotReady;
+
+			/*
+			 * The socket is only watched for disconnection from now on.
+			 */
+			reactor->Modify(socket_fd, context, Reactor::HANGUP);
+			reactor->Add(event_fd, context, Reactor::READ);
+		}
+	}
+	catch (std::runtime_error& e) {
+		LOG_DEBUG("Voodoo::SharedChannel::Prepare() %s\n", e.what());
+
+		return sf::Socket::Error;
+	}
+
+	/*
+	 * Woken for new requests as well as for space in the reply ring.
+	 */
+	eventfd_t value;
+
+	eventfd_read(event_fd, &value);
+
+	return sf::Socket::Done;
+}
+
+sf::Socket::Status SharedChannel::Receive(std::unique_ptr<sf::Packet>& packet, int timeout_ms)
+{
+	try {
+		sf::Socket::Status status = receive(packet);
+
+		if (status != sf::Socket::NotReady || !timeout_ms)
+			return status;
+
+		if (!wait(timeout_ms))
+			return sf::Socket::Disconnected;
+
+		return receive(packet);
+	}
+	catch (std::runtime_error&) {
+		return sf::Socket::Error;
+	}
+}
+
+bool SharedChannel::attach()
+{
+	sf::Uint32 ring_size = 0;
+	int fds[2] = { -1, -1 };
+
+	struct iovec iov = { &ring_size, sizeof(ring_size) };
+	char control[CMSG_SPACE(sizeof(fds))] = {};
+
+	struct msghdr msg = {};
+
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	ssize_t received = recvmsg(socket_fd, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+
+	if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+		return false;
+
+	struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+
+	if (received > 0 && cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+		size_t count = std::min((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int), (size_t)2);
+
+		memcpy(fds, CMSG_DATA(cmsg), count * sizeof(int));
+	}
+
+	/*
+	 * Closed by the destructor, reads must not block the server.
+	 */
+	event_fd = fds[1];
+
+	if (event_fd >= 0)
+		fcntl(event_fd, F_SETFL, O_NONBLOCK);
+
+	/*
+	 * Everything sent by the client is checked before mapping the memory.
+	 */
+	struct stat st;
+
+	bool valid = received == sizeof(ring_size) && fds[0] >= 0 && fds[1] >= 0 &&
+				 ring_size >= 4096 && ring_size <= (1u << 30) && !(ring_size & (ring_size - 1)) &&
+				 fstat(fds[0], &st) == 0 && (size_t)st.st_size == 2 * sizeof(Header) + 2 * ring_size &&
+				 (fcntl(fds[0], F_GET_SEALS) & (F_SEAL_SHRINK | F_SEAL_SEAL)) == (F_SEAL_SHRINK | F_SEAL_SEAL);
+
+	try {
+		if (!valid)
+			throw std::runtime_error("invalid shared memory connection");
+
+		map(fds[0], ring_size, true);
+	}
+	catch (...) {
+		if (fds[0] >= 0)
+			::close(fds[0]);
+
+		throw;
+	}
+
+	::close(fds[0]);
+
+	return true;
+}
+
+sf::Socket::Status SharedChannel::Send(const sf::Packet& head, const sf::Packet* body)
+{
+	try {
+		if (!send(head, body))
+			return send_offset ? sf::Socket::Partial : sf::Socket::NotReady;
+	}
+	catch (std::runtime_error&) {
+		return sf::Socket::Error;
+	}
+
+	return sf::Socket::Done;
+}
+
+bool SharedChannel::send(const sf::Packet& head, const sf::Packet* body)
+{
+	size_t head_end = sizeof(sf::Uint32) + head.getDataSize();
+
+	sf::Uint32 size = htonl((sf::Uint32)(head.getDataSize() + (body ? body->getDataSize() : 0)));
+
+	size_t total = head_end + (body ? body->getDataSize() : 0);
+
+	while (send_offset < total) {
+		if (send_offset < sizeof(size))
+			send_offset += output.Write((const sf::Uint8*)&size + send_offset, sizeof(size) - send_offset);
+		else if (output.Space()) {
+			if (send_offset < head_end)
+				send_offset += output.Write((const sf::Uint8*)head.getData() + send_offset - sizeof(size), head_end - send_offset);
+			else
+				send_offset += output.Write((const sf::Uint8*)body->getData() + send_offset - head_end, total - send_offset);
+		}
+		else {
+			/*
+			 * Let the client make room and wake us, unless it did before seeing us waiting.
+			 */
+			output.WakeReader();
+
+			output.header->writer_waiting.store(1);
+
+			if (!output.Space())
+				return false;
+
+			output.header->writer_waiting.store(0);
+		}
+	}
+
+	send_offset = 0;
+
+	output.WakeReader();
+
+	return true;
+}
+
+void SharedChannel::Shutdown()
+{
+	::shutdown(socket_fd, SHUT_RDWR);
+}
+
+void SharedChannel::Send(sf::Packet& request, const std::vector<Data>& blobs)
+{
+	size_t total = request.getDataSize();
+
+	for (auto& blob : blobs) {
+		sf::Packet prefix;
+
+		put_data_prefix(prefix, blob.size());
+
+		total += prefix.getDataSize() + blob.size();
+	}
+
+	if (total > 0xffffffff)
+		throw std::runtime_error("request too large");
+
+	/*
+	 * Same framing as sf::Packet on TCP, the data buffers are copied into the ring only.
+	 */
+	sf::Uint32 size = htonl((sf::Uint32)total);
+
+	write(&size, sizeof(size));
+	write(request.getData(), request.getDataSize());
+
+	for (auto& blob : blobs) {
+		sf::Packet prefix;
+
+		put_data_prefix(prefix, blob.size());
+
+		write(prefix.getData(), prefix.getDataSize());
+		write(blob.data(), blob.size());
+	}
+
+	output.WakeReader();
+}
+
+sf::Socket::Status SharedChannel::receive(std::unique_ptr<sf::Packet>& packet)
+{
+	while (true) {
+		size_t missing = 0;
+
+		if (size_received == sizeof(size_bytes)) {
+			sf::Uint32 size;
+
+			memcpy(&size, size_bytes, sizeof(size));
+
+			missing = ntohl(size) - incoming->getDataSize();
+
+			if (!missing) {
+				size_received = 0;
+
+				packet = std::move(incoming);
+
+				return sf::Socket::Done;
+			}
+		}
+
+		const sf::Uint8* ptr;
+
+		size_t available = input.Readable(&ptr);
+
+		if (!available) {
+			/*
+			 * Announce going to sleep and check again, the writer may have missed it.
+			 */
+			input.header->reader_waiting.store(1);
+
+			available = input.Readable(&ptr);
+
+			if (!available)
+				return sf::Socket::NotReady;
+
+			input.header->reader_waiting.store(0);
+		}
+
+		size_t used;
+
+		if (size_received < sizeof(size_bytes)) {
+			used = std::min(available, sizeof(size_bytes) - size_received);
+
+			memcpy(size_bytes + size_received, ptr, used);
+
+			size_received += used;
+
+			if (size_received == sizeof(size_bytes)) {
+				sf::Uint32 size;
+
+				memcpy(&size, size_bytes, sizeof(size));
+
+				if (ntohl(size) > MAX_PACKET_SIZE)
+					return sf::Socket::Error;
+
+				incoming = std::make_unique<sf::Packet>();
+			}
+		}
+		else {
+			used = std::min(available, missing);
+
+			incoming->append(ptr, used);
+		}
+
+		input.Consume(used);
+		input.WakeWriter();
+	}
+}
+
+bool SharedChannel::wait(int timeout_ms)
+{
+	const sf::Uint8* ptr;
+
+	input.header->reader_waiting.store(0);
+
+	/*
+	 * Spin briefly first, replies to calls often arrive within microseconds.
+	 *
+	 * Not on a single CPU, where spinning only delays the server.
+	 */
+	static const bool spin = std::thread::hardware_concurrency() > 1;
+
+	auto spin_end = std::chrono::steady_clock::now() + std::chrono::microseconds(spin ? 20 : 0);
+
+	do {
+		if (input.Readable(&ptr))
+			return true;
+	} while (std::chrono::steady_clock::now() < spin_end);
+
+	input.header->reader_waiting.store(1);
+
+	if (input.Readable(&ptr) || futex_wait(&input.header->reader_waiting, 1, timeout_ms))
+		return true;
+
+	return connected();
+}
+
+void SharedChannel::map(int memory_fd, size_t ring_size, bool server)
+{
+	memory_size = 2 * sizeof(Header) + 2 * ring_size;
+
+	void* ptr = mmap(NULL, memory_size, PROT_READ | PROT_WRITE, MAP_SHARED, memory_fd, 0);
+
+	if (ptr == MAP_FAILED)
+		throw std::runtime_error("could not map shared memory");
+
+	memory = ptr;
+
+	/*
+	 * Headers of both rings followed by the request ring and the reply ring.
+	 *
+	 * Requests are read by the server (woken via eventfd) and written by the client (futex),
+	 * replies are read by the client (futex) and written by the server (eventfd).
+	 */
+	Header* headers = (Header*)memory;
+	sf::Uint8* data = (sf::Uint8*)(headers + 2);
+
+	Ring requests = { &headers[0], data, ring_size, 0, event_fd, -1 };
+	Ring replies = { &headers[1], data + ring_size, ring_size, 0, -1, event_fd };
+
+	input = server ? requests : replies;
+	output = server ? replies : requests;
+}
+
+void SharedChannel::write(const void* ptr, size_t size)
+{
+	while (size) {
+		size_t written = output.Write(ptr, size);
+
+		ptr = (const sf::Uint8*)ptr + written;
+		size -= written;
+
+		if (written || !size)
+			continue;
+
+		/*
+		 * Let the server make room, then sleep until it did.
+		 */
+		output.WakeReader();
+
+		output.header->writer_waiting.store(1);
+
+		if (output.Space()) {
+			output.header->writer_waiting.store(0);
+			continue;
+		}
+
+		if (!futex_wait(&output.header->writer_waiting, 1, 50) && !connected())
+			throw std::runtime_error("could not send request");
+	}
+}
+
+bool SharedChannel::connected()
+{
+	struct pollfd fd = { socket_fd, POLLRDHUP, 0 };
+
+	/*
+	 * Nothing is ever sent on the socket, so any event means the server is gone.
+	 */
+	return poll(&fd, 1, 0) == 0;
+}
+
+
+
+SharedListener::SharedListener(int port)
+	:
+	fd(unix_listen(shared_path(port)))
+{
+}
+
+SharedListener::~SharedListener()
+{
+	::close(fd);
+}
+
+void SharedListener::Watch(Reactor& reactor, void* context)
+{
+	Listener::Watch(reactor, context);
+
+	reactor.Add(fd, context, Reactor::READ);
+}
+
+void SharedListener::Enable(bool enable)
+{
+	reactor->Modify(fd, context, enable ? Reactor::READ : 0);
+}
+
+std::unique_ptr<Channel> SharedListener::Accept()
+{
+	int channel_fd = unix_accept(fd);
+
+	if (channel_fd < 0)
+		return nullptr;
+
+	return std::make_unique<SharedChannel>(channel_fd);
+}
+
+#endif
+
+
+LoopbackChannel::LoopbackChannel(std::shared_ptr<Pipe> pipe, bool server_end)
+	:
+	pipe(pipe),
+	server_end(server_end)
+{
+}
+
+LoopbackChannel::~LoopbackChannel()
+{
+	std::unique_lock<std::mutex> l(pipe->lock);
+
+	if (pipe->closed)
+		return;
+
+	pipe->closed = true;
+
+	Hangup hangup = pipe->hangup;
+
+	pipe->deliver = nullptr;
+	pipe->hangup = nullptr;
+
+	l.unlock();
+
+	pipe->ready.notify_all();
+
+	/*
+	 * The server end is destroyed by the server when closing the connection.
+	 */
+	if (!server_end)
+		hangup();
+}
+
+std::pair<std::unique_ptr<Channel>, std::unique_ptr<Channel>> LoopbackChannel::Create(Deliver deliver, Hangup hangup)
+{
+	auto pipe = std::make_shared<Pipe>();
+
+	pipe->deliver = deliver;
+	pipe->hangup = hangup;
+
+	return std::make_pair(std::unique_ptr<Channel>(new LoopbackChannel(pipe, true)),
+						  std::unique_ptr<Channel>(new LoopbackChannel(pipe, false)));
+}
+
+void LoopbackChannel::Unwatch()
+{
+}
+
+sf::Socket::Status LoopbackChannel::Receive(std::unique_ptr<sf::Packet>& packet, int timeout_ms)
+{
+	/*
+	 * Requests are delivered to the server directly.
+	 */
+	if (server_end)
+		return sf::Socket::NotReady;
+
+	std::unique_lock<std::mutex> l(pipe->lock);
+
+	pipe->ready.wait_for(l, std::chrono::milliseconds(timeout_ms), [this] {
+			return !pipe->replies.empty() || pipe->closed;
+		});
+
+	if (pipe->replies.empty())
+		return pipe->closed ? sf::Socket::Disconnected : sf::Socket::NotReady;
+
+	packet = std::move(pipe->replies.front());
+
+	pipe->replies.pop_front();
+
+	return sf::Socket::Done;
+}
+
+sf::Socket::Status LoopbackChannel::Send(const sf::Packet& head, const sf::Packet* body)
+{
+	auto reply = std::make_unique<sf::Packet>(head);
+
+	if (body)
+		reply->append(body->getData(), body->getDataSize());
+
+	std::unique_lock<std::mutex> l(pipe->lock);
+
+	if (pipe->closed)
+		return sf::Socket::Disconnected;
+
+	pipe->replies.push_back(std::move(reply));
+
+	l.unlock();
+
+	pipe->ready.notify_one();
+
+	return sf::Socket::Done;
+}
+
+void LoopbackChannel::Send(sf::Packet& request, const std::vector<Data>& blobs)
+{
+	auto packet = std::make_unique<sf::Packet>();
+
+	packet->append(request.getData(), request.getDataSize());
+
+	for (auto& blob : blobs) {
+		put_data_prefix(*packet, blob.size());
+
+		packet->append(blob.data(), blob.size());
+	}
+
+	std::unique_lock<std::mutex> l(pipe->lock);
+
+	if (pipe->closed)
+		throw std::runtime_error("could not send request");
+
+	/*
+	 * Called without holding the lock, as replies may be sent right away.
+	 */
+	Deliver deliver = pipe->deliver;
+
+	l.unlock();
+
+	deliver(std::move(packet));
+}
+
+
+thread_local Server::Connection* Server::current_client;
+
+Server::Server(unsigned int num_workers)
+	:
+	accepting(true),
+	serials(0),
+	request_ids(0),
+	max_queued(0),
+	overflow_policy(DROP_OLDEST),
+	num_clients(0),
+	max_clients(0),
+	num_workers(num_workers),
+	running(false)
+{
+}
+
+Server::~Server() noexcept(false)
+{
+	std::unique_lock<std::mutex> l(lock);
+
+	if (running)
+		throw std::runtime_error("server not stopped before destruction");
+
+	for (auto connection : clients)
+		delete connection;	// NULL for free slots
+}
+
+void Server::Listen(int port)
+{
+	Listen(std::make_unique<TcpListener>(port));
+}
+
+#ifdef __linux__
+
+void Server::ListenUnix(std::string path)
+{
+	Listen(std::make_unique<UnixListener>(path));
+}
+
+void Server::ListenShared(int port)
+{
+	Listen(std::make_unique<SharedListener>(port));
+}
+
+#endif
+
+void Server::Listen(std::unique_ptr<Listener> listener)
+{
+	std::unique_lock<std::mutex> l(lock);
+
+	listener->Watch(reactor, listener.get());
+
+	if (!accepting)
+		listener->Enable(false);
+
+	listeners.push_back(std::move(listener));
+
+	running = true;
+}
+
+std::unique_ptr<Channel> Server::ConnectLoopback()
+{
+	std::unique_lock<std::mutex> l(lock);
+
+	Connection* connection = new Connection();
+
+	auto channels = LoopbackChannel::Create([this, connection](std::unique_ptr<sf::Packet> request) {
+			std::unique_lock<std::mutex> l(lock);
+
+			process(connection, std::move(request), l);
+
+			/*
+			 * Requests may be handled without Run(), so connections shut down meanwhile are closed here too.
+			 */
+			close_disconnected();
+		}, [this, connection]() {
+			std::unique_lock<std::mutex> l(lock);
+
+			close(connection);
+		});
+
+	connection->channel = std::move(channels.first);
+	connection->channel->Watch(reactor, connection);
+
+	add(connection);
+
+	running = true;
+
+	return std::move(channels.second);
+}
+
+void Server::Run()
+{
+	std::unique_lock<std::mutex> l(lock);
+
+	for (unsigned int i = 0; i < num_workers; i++)
+		workers.push_back(std::thread([this] () {
+				work();
+			}));
+
+	std::vector<Reactor::Event> events;
+
+	std::unique_lock<std::mutex> tl(timers_lock);
+
+	run_thread = std::this_thread::get_id();
+
+	tl.unlock();
+
+	while (running) {
+		l.unlock();
+
+		int timeout_ms = run_timers();
+
+		reactor.Wait(events, timeout_ms);
+
+		l.lock();
+
+		for (auto& event : events) {
+			/*
+			 * Removed while handling a previous event.
+			 */
+			if (!event.context)
+				continue;
+
+			if (Listener* listener = find_listener(event.context)) {
+				accept(listener);
+				continue;
+			}
+
+			receive((Connection*)event.context, event.events, l);
+		}
+
+		close_disconnected();
+	}
+
+	l.unlock();
+
+	ready.notify_all();
+
+	for (auto& worker : workers)
+		worker.join();
+
+	workers.clear();
+}
+
+void Server::Stop()
+{
+	std::unique_lock<std::mutex> l(lock);
+
+	running = false;
+
+	ready.notify_all();
+
+	reactor.Wake();
+}
+
+void Server::AddTimer(ID timer_id, std::chrono::milliseconds interval, TimerHandler handler)
+{
+	std::unique_lock<std::mutex> l(timers_lock);
+
+	timers[timer_id] = Timer{ interval, std::chrono::steady_clock::now() + interval, handler };
+
+	l.unlock();
+
+	/*
+	 * Run() may be waiting without a timeout.
+	 */
+	reactor.Wake();
+}
+
+void Server::RemoveTimer(ID timer_id)
+{
+	std::unique_lock<std::mutex> l(timers_lock);
+
+	timers.erase(timer_id);
+
+	if (std::this_thread::get_id() != run_thread)
+		timer_done.wait(l, [this, timer_id]() {
+				return running_timer != timer_id;
+			});
+}
+
+int Server::run_timers()
+{
+	std::unique_lock<std::mutex> l(timers_lock);
+
+	auto now = std::chrono::steady_clock::now();
+
+	for (auto& timer : timers) {
+		if (timer.second.due <= now)
+			due_timers.push_back(timer.first);
+	}
+
+	for (auto timer_id : due_timers) {
+		/*
+		 * Removed by a previous handler.
+		 */
+		auto timer = timers.find(timer_id);
+
+		if (timer == timers.end())
+			continue;
+
+		timer->second.due = std::max(timer->second.due + timer->second.interval, now);
+
+		TimerHandler handler = timer->second.handler;
+
+		running_timer = timer_id;
+
+		l.unlock();
+
+		try {
+			handler();
+		}
+		catch (std::exception& e) {
+			LOG_DEBUG("Voodoo::Server::run_timers() handler failed: %s\n", e.what());
+		}
+
+		l.lock();
+
+		running_timer = ID();
+
+		timer_done.notify_all();
+	}
+
+	due_timers.clear();
+
+	if (timers.empty())
+		return -1;
+
+	now = std::chrono::steady_clock::now();
+
+	auto next = timers.begin()->second.due;
+
+	for (auto& timer : timers)
+		next = std::min(next, timer.second.due);
+
+	if (next <= now)
+		return 0;
+
+	return (int)std::chrono::duration_cast<std::chrono::milliseconds>(next - now + std::chrono::microseconds(999)).count();
+}
+
+void Server::PushCleanup(Voodoo::ID cleanup_id, CleanupHandler handler)
+{
+	if (!current_client)
+		throw std::runtime_error("no current client");
+
+	current_client->cleanups.push_back(std::make_pair(cleanup_id, handler));
+}
+
+void Server::RemoveCleanup(Voodoo::ID cleanup_id)
+{
+	if (!current_client)
+		throw std::runtime_error("no current client");
+
+	auto& cleanups = current_client->cleanups;
+
+	for (auto it = cleanups.begin(); it != cleanups.end(); it++) {
+		if (it->first == cleanup_id) {
+			cleanups.erase(it);
+			break;
+		}
+	}
+}
+
+Server::ClientID Server::GetCurrentClient()
+{
+	if (!current_client)
+		throw std::runtime_error("no current client");
+
+	ClientID client;
+
+	client.slot = current_client->slot;
+	client.serial = current_client->serial;
+
+	return client;
+}
+
+bool Server::post(ClientID client, std::unique_ptr<sf::Packet> request, std::shared_ptr<const sf::Packet> body)
+{
+	/*
+	 * Closing the connection waits for the lock, so it is not deleted while sending.
+	 */
+	std::unique_lock<std::mutex> l(connections_lock);
+
+	Connection* connection = find_connection(client);
+
+	if (!connection)
+		return false;
+
+	send(connection, std::move(request), std::move(body), true);
+
+	return true;
+}
+
+Server::Connection* Server::find_connection(ClientID client)
+{
+	if (client.slot >= clients.size() || !clients[client.slot] || clients[client.slot]->serial != client.serial)
+		return NULL;
+
+	return clients[client.slot];
+}
+
+sf::Uint32 Server::make_request_id()
+{
+	sf::Uint32 request_id;
+
+	while (!(request_id = ++request_ids));
+
+	return request_id;
+}
+
+bool Server::submit(ClientID client, sf::Uint32 request_id, std::unique_ptr<sf::Packet> request, ReplyHandler handler)
+{
+	std::unique_lock<std::mutex> l(connections_lock);
+
+	Connection* connection = find_connection(client);
+
+	if (!connection)
+		return false;
+
+	/*
+	 * Add pending call before sending, as the reply may arrive before send() returns.
+	 */
+	connection->pending[request_id] = handler;
+
+	send(connection, std::move(request));
+
+	return true;
+}
+
+void Server::handle_reply(Connection* connection, std::shared_ptr<sf::Packet> reply)
+{
+	Reader reader(reply, sizeof(ID));
+
+	sf::Uint32 request_id;
+
+	reader >> request_id;
+
+	std::unique_lock<std::mutex> l(connections_lock);
+
+	auto it = connection->pending.find(request_id);
+
+	if (it == connection->pending.end()) {
+		LOG_DEBUG("Voodoo::Server::handle_reply() invalid request id %u\n", request_id);
+		return;
+	}
+
+	ReplyHandler handler = it->second;
+
+	connection->pending.erase(it);
+
+	l.unlock();
+
+	handler(reader);
+}
+
+void Server::SetMaxConnections(size_t max_connections)
+{
+	std::unique_lock<std::mutex> l(lock);
+
+	max_clients = max_connections;
+}
+
+size_t Server::GetConnectionCount()
+{
+	std::unique_lock<std::mutex> l(lock);
+
+	return num_clients;
+}
+
+void Server::SetQueueLimit(size_t max_bytes, OverflowPolicy policy)
+{
+	std::unique_lock<std::mutex> l(connections_lock);
+
+	max_queued = max_bytes;
+	overflow_policy = policy;
+
+	for (auto connection : clients) {
+		if (!connection)
+			continue;
+
+		std::unique_lock<std::mutex> sl(connection->send_lock);
+
+		connection->max_queued = max_bytes;
+		connection->overflow_policy = policy;
+	}
+}
+
+bool Server::SetQueueLimit(ClientID client, size_t max_bytes, OverflowPolicy policy)
+{
+	std::unique_lock<std::mutex> l(connections_lock);
+
+	Connection* connection = find_connection(client);
+
+	if (!connection)
+		return false;
+
+	std::unique_lock<std::mutex> sl(connection->send_lock);
+
+	connection->max_queued = max_bytes;
+	connection->overflow_policy = policy;
+
+	return true;
+}
+
+bool Server::GetQueueStatistics(ClientID client, QueueStatistics& statistics)
+{
+	std::unique_lock<std::mutex> l(connections_lock);
+
+	Connection* connection = find_connection(client);
+
+	if (!connection)
+		return false;
+
+	std::unique_lock<std::mutex> sl(connection->send_lock);
+
+	statistics.packets = connection->replies.size();
+	statistics.bytes = connection->queued;
+	statistics.dropped = connection->dropped;
+	statistics.disconnects = connection->overflowed;
+
+	return true;
+}
+
+Server::QueueStatistics Server::GetQueueStatistics()
+{
+	std::unique_lock<std::mutex> l(connections_lock);
+
+	QueueStatistics statistics = closed_queues;
+
+	for (auto connection : clients) {
+		if (!connection)
+			continue;
+
+		std::unique_lock<std::mutex> sl(connection->send_lock);
+
+		statistics.packets += connection->replies.size();
+		statistics.bytes += connection->queued;
+		statistics.dropped += connection->dropped;
+		statistics.disconnects += connection->overflowed;
+	}
+
+	return statistics;
+}
+
+Listener* Server::find_listener(void* context)
+{
+	for (auto& listener : listeners) {
+		if (listener.get() == context)
+			return listener.get();
+	}
+
+	return NULL;
+}
+
+void Server::accept(Listener* listener)
+{
+	while (!max_clients || num_clients < max_clients) {
+		std::unique_ptr<Channel> channel;
+
+		try {
+			channel = listener->Accept();
+		}
+		catch (std::runtime_error&) {
+			/*
+			 * Most likely out of file descriptors, retry when a connection is closed.
+			 */
+			if (num_clients)
+				set_accepting(false);
+			return;
+		}
+
+		if (!channel)
+			return;
+
+		Connection* connection = new Connection();
+
+		connection->channel = std::move(channel);
+
+		add(connection);
+
+		connection->channel->Watch(reactor, connection);
+	}
+
+	set_accepting(false);
+}
+
+void Server::add(Connection* connection)
+{
+	std::unique_lock<std::mutex> l(connections_lock);
+
+	connection->serial = ++serials;
+	connection->max_queued = max_queued;
+	connection->overflow_policy = overflow_policy;
+
+	if (free_slots.empty()) {
+		connection->slot = clients.size();
+
+		clients.push_back(connection);
+	}
+	else {
+		connection->slot = free_slots.back();
+
+		free_slots.pop_back();
+
+		clients[connection->slot] = connection;
+	}
+
+	num_clients++;
+}
+
+void Server::receive(Connection* connection, int events, std::unique_lock<std::mutex>& l)
+{
+	Channel* channel = connection->channel.get();
+
+	switch (channel->Prepare(events)) {
+	case sf::Socket::Done:
+		break;
+
+	case sf::Socket::NotReady:
+		return;
+
+	default:
+		close(connection);
+		return;
+	}
+
+	std::unique_lock<std::mutex> sl(connection->send_lock);
+
+	bool overflowed = connection->overflowed;
+
+	sl.unlock();
+
+	if (overflowed) {
+		close(connection);
+		return;
+	}
+
+	flush(connection);
+
+	if (!(events & (Reactor::READ | Reactor::HANGUP)))
+		return;
+
+	while (true) {
+		std::unique_ptr<sf::Packet> request;
+
+		switch (channel->Receive(request)) {
+		case sf::Socket::Done:
+			if (!process(connection, std::move(request), l))
+				return;
+			break;
+
+		case sf::Socket::NotReady:
+		case sf::Socket::Partial:
+			/*
+			 * Requests sent before disconnecting have been received above.
+			 */
+			if (events & Reactor::HANGUP)
+				close(connection);
+			return;
+
+		default:
+			close(connection);
+			return;
+		}
+	}
+}
+
+bool Server::process(Connection* connection, std::unique_ptr<sf::Packet> request, std::unique_lock<std::mutex>& l)
+{
+	if (!connection->version_checked) {
+		check_version(connection, *request);
+		return true;
+	}
+
+	/*
+	 * Replies to calls of the server are handled right away, as handlers of the connection may be waiting for them.
+	 */
+	ID method_id;
+
+	if (request->getDataSize() >= sizeof(ID) && !(Reader(*request) >> method_id, method_id)) {
+		try {
+			handle_reply(connection, std::move(request));
+		}
+		catch (std::runtime_error& e) {
+			LOG_DEBUG("Voodoo::Server::process() %s\n", e.what());
+		}
+		return true;
+	}
+
+	connection->requests.push_back(std::move(request));
+
+	/*
+	 * Requests of loopback connections may arrive before the workers are started by Run().
+	 */
+	if (num_workers) {
+		schedule(connection);
+		return true;
+	}
+
+	/*
+	 * Without workers requests are handled right here, but without holding the lock. Requests of loopback
+	 * connections arriving meanwhile from other threads are queued and handled in order by this loop.
+	 */
+	if (connection->busy)
+		return true;
+
+	connection->busy = true;
+
+	while (!connection->requests.empty()) {
+		auto next = std::move(connection->requests.front());
+
+		connection->requests.pop_front();
+
+		l.unlock();
+
+		handle(connection, *next);
+
+		l.lock();
+	}
+
+	connection->busy = false;
+
+	if (connection->closed) {
+		l.unlock();
+
+		cleanup(connection);
+
+		delete connection;
+
+		l.lock();
+
+		return false;
+	}
+
+	return true;
+}
+
+void Server::check_version(Connection* connection, sf::Packet& request)
+{
+	ID method_id;
+	sf::Uint32 request_id;
+	sf::Uint32 version;
+
+	if (!(request >> method_id >> request_id >> version) || method_id != CHECK_VERSION || !request_id) {
+		LOG_DEBUG("Voodoo::Server::check_version() client did not send a version\n");
+
+		disconnect(connection);
+		return;
+	}
+
+	LOG_DEBUG("Voodoo::Server::check_version(%u)\n", version);
+
+	auto reply = std::make_unique<sf::Packet>();
+
+	*reply << request_id << WIRE_VERSION;
+
+	send(connection, std::move(reply));
+
+	if (version != WIRE_VERSION) {
+		disconnect(connection);
+		return;
+	}
+
+	connection->version_checked = true;
+}
+
+void Server::send(Connection* connection, std::unique_ptr<sf::Packet> packet, std::shared_ptr<const sf::Packet> body, bool posted)
+{
+	std::unique_lock<std::mutex> l(connection->send_lock);
+
+	if (connection->overflowed)
+		return;
+
+	Outgoing outgoing{ std::move(packet), std::move(body), posted };
+
+	size_t size = outgoing.size();
+
+	if (connection->replies.empty()) {
+		switch (connection->channel->Send(*outgoing.head, outgoing.body.get())) {
+		case sf::Socket::Done:
+			return;
+
+		case sf::Socket::NotReady:
+		case sf::Socket::Partial:
+			break;
+
+		default:
+			/*
+			 * Disconnect is handled when receiving.
+			 */
+			return;
+		}
+
+		connection->channel->WaitWritable(true);
+	}
+	else if (connection->max_queued && connection->queued + size > connection->max_queued) {
+		if (!overflow(connection, size, posted))
+			return;
+	}
+
+	connection->queued += size;
+
+	connection->replies.push_back(std::move(outgoing));
+}
+
+bool Server::overflow(Connection* connection, size_t size, bool posted)
+{
+	auto& replies = connection->replies;
+
+	switch (connection->overflow_policy) {
+	case DROP_OLDEST:
+		/*
+		 * The front may have been sent partially already.
+		 */
+		for (auto it = std::next(replies.begin()); it != replies.end() && connection->queued + size > connection->max_queued;) {
+			if (it->posted) {
+				connection->queued -= it->size();
+				connection->dropped++;
+
+				it = replies.erase(it);
+			}
+			else
+				it++;
+		}
+
+		if (!posted || connection->queued + size <= connection->max_queued)
+			return true;
+		break;
+
+	case DROP_NEWEST:
+		if (!posted)
+			return true;
+		break;
+
+	case DISCONNECT:
+		LOG_DEBUG("Voodoo::Server::overflow() disconnecting client with %zu bytes queued\n", connection->queued);
+
+		connection->overflowed = true;
+		connection->queued = 0;
+
+		replies.clear();
+
+		disconnect(connection);
+		return false;
+	}
+
+	connection->dropped++;
+
+	return false;
+}
+
+void Server::flush(Connection* connection)
+{
+	std::unique_lock<std::mutex> l(connection->send_lock);
+
+	if (connection->replies.empty())
+		return;
+
+	while (!connection->replies.empty()) {
+		auto& outgoing = connection->replies.front();
+
+		switch (connection->channel->Send(*outgoing.head, outgoing.body.get())) {
+		case sf::Socket::Done:
+			connection->queued -= outgoing.size();
+			connection->replies.pop_front();
+			break;
+
+		case sf::Socket::NotReady:
+		case sf::Socket::Partial:
+			return;
+
+		default:
+			connection->queued = 0;
+			connection->replies.clear();
+			break;
+		}
+	}
+
+	connection->channel->WaitWritable(false);
+}
+
+void Server::close(Connection* connection)
+{
+	std::unique_lock<std::mutex> cl(connections_lock);
+
+	clients[connection->slot] = NULL;
+
+	std::unique_lock<std::mutex> sl(connection->send_lock);
+
+	closed_queues.dropped += connection->dropped;
+	closed_queues.disconnects += connection->overflowed;
+
+	sl.unlock();
+
+	/*
+	 * Dropping the handlers breaks the promises of pending calls to the client.
+	 */
+	auto pending = std::move(connection->pending);
+
+	connection->pending.clear();
+
+	cl.unlock();
+
+	pending.clear();
+
+	connection->channel->Unwatch();
+
+	free_slots.push_back(connection->slot);
+
+	num_clients--;
+
+	set_accepting(true);
+
+	/*
+	 * Busy connections are cleaned up by the worker after handling the remaining requests.
+	 */
+	if (connection->busy)
+		connection->closed = true;
+	else {
+		cleanup(connection);
+
+		delete connection;
+	}
+}
+
+void Server::disconnect(Connection* connection)
+{
+	connection->channel->Shutdown();
+
+	std::unique_lock<std::mutex> l(disconnect_lock);
+
+	ClientID client;
+
+	client.slot = connection->slot;
+	client.serial = connection->serial;
+
+	disconnected.push_back(client);
+
+	l.unlock();
+
+	reactor.Wake();
+}
+
+void Server::close_disconnected()
+{
+	std::unique_lock<std::mutex> l(disconnect_lock);
+
+	auto clients = std::move(disconnected);
+
+	disconnected.clear();
+
+	l.unlock();
+
+	for (auto client : clients) {
+		std::unique_lock<std::mutex> cl(connections_lock);
+
+		Connection* connection = find_connection(client);
+
+		cl.unlock();
+
+		/*
+		 * Closed already when the reactor reported the shutdown.
+		 */
+		if (connection)
+			close(connection);
+	}
+}
+
+void Server::set_accepting(bool enable)
+{
+	if (accepting == enable)
+		return;
+
+	for (auto& listener : listeners)
+		listener->Enable(enable);
+
+	accepting = enable;
+}
+
+void Server::cleanup(Connection* connection)
+{
+	for (auto it = connection->cleanups.rbegin(); it != connection->cleanups.rend(); it++)
+		it->second();
+
+	connection->cleanups.clear();
+}
+
+void Server::schedule(Connection* connection)
+{
+	if (connection->busy)
+		return;
+
+	connection->busy = true;
+
+	queue.push_back(connection);
+
+	ready.notify_one();
+}
+
+void Server::work()
+{
+	std::unique_lock<std::mutex> l(lock);
+
+	while (true) {
+		ready.wait(l, [this] { return !queue.empty() || !running; });
+
+		/*
+		 * Remaining requests are handled before the worker exits.
+		 */
+		if (queue.empty())
+			break;
+
+		Connection* connection = queue.front();
+
+		queue.pop_front();
+
+		auto request = std::move(connection->requests.front());
+
+		connection->requests.pop_front();
+
+		l.unlock();
+
+		handle(connection, *request);
+
+		l.lock();
+
+		/*
+		 * Requeue at the end for fairness among connections.
+		 */
+		if (!connection->requests.empty()) {
+			queue.push_back(connection);
+			continue;
+		}
+
+		connection->busy = false;
+
+		if (connection->closed) {
+			l.unlock();
+
+			cleanup(connection);
+
+			delete connection;
+
+			l.lock();
+		}
+	}
+}
+
+void Server::handle(Connection* connection, sf::Packet& request)
+{
+	auto reply = std::make_unique<sf::Packet>();
+
+	current_client = connection;
+
+	bool send_reply;
+
+	/*
+	 * Errors of a request must neither terminate the thread nor affect other requests.
+	 */
+	try {
+		send_reply = dispatch(request, *reply);
+	}
+	catch (std::exception& e) {
+		LOG_DEBUG("Voodoo::Server::handle() %s\n", e.what());
+
+		send_reply = error_reply(request, *reply);
+	}
+	catch (...) {
+		LOG_DEBUG("Voodoo::Server::handle() unknown exception\n");
+
+		send_reply = error_reply(request, *reply);
+	}
+
+	current_client = NULL;
+
+	if (send_reply)
+		send(connection, std::move(reply));
+}
+
+bool Server::error_reply(const sf::Packet& request, sf::Packet& reply)
+{
+	sf::Uint32 request_id = 0;
+
+	reply.clear();
+
+	if (request.getDataSize() >= sizeof(ID) + sizeof(request_id))
+		Reader(request, sizeof(ID)) >> request_id;
+
+	/*
+	 * Reply without values, so the client does not wait forever.
+	 */
+	if (request_id)
+		reply << request_id;
+
+	return request_id != 0;
+}
+
+bool Server::dispatch(sf::Packet& request, sf::Packet &reply)
+{
+	ID method_id;
+	sf::Uint32 request_id;
+
+	if (request >> method_id >> request_id) {
+		LOG_DEBUG("Voodoo::Server::dispatch(%zu, [%llu], #%u)\n",
+				  request.getDataSize(), *method_id, request_id);
+
+		Reader reader(request, sizeof(ID) + sizeof(request_id));
+
+		/*
+		 * Posted calls (request ID zero) do not get a reply.
+		 */
+		if (!request_id) {
+			Handle(method_id, reader, NULL);
+
+			return false;
+		}
+
+		/*
+		 * Echo the request ID for the client to match the reply.
+		 */
+		reply << request_id;
+
+		Handle(method_id, reader, &reply);
+	}
+
+	return true;
+}
+
+
+Client::Client()
+	:
+	receiver(0),
+	running(false),
+	request_ids(0)
+{
+}
+
+Client::~Client()
+{
+	std::unique_lock<std::mutex> l(lock);
+
+	running = false;
+
+	l.unlock();
+
+	if (receiver) {
+		receiver->join();
+
+		delete receiver;
+	}
+}
+
+void Client::Connect(std::string host, int port)
+{
+	Connect(TcpChannel::Connect(host, port));
+}
+
+#ifdef __linux__
+
+void Client::ConnectUnix(std::string path)
+{
+	Connect(UnixChannel::Connect(path));
+}
+
+void Client::ConnectShared(int port)
+{
+	Connect(SharedChannel::Connect(port));
+}
+
+#endif
+
+void Client::Connect(std::unique_ptr<Channel> channel)
+{
+	if (receiver)
 		throw std::runtime_error("client already connected");
 
-	if (socket.connect(host, port) != sf::Socket::Done)
-		throw std::runtime_error("could not connect");
+	this->channel = std::move(channel);
+
+	running = true;
+
+	receiver = new std::thread([this] () {
+			receive_replies();
+		});
+
+	check_version();
+}
+
+void Client::check_version()
+{
+	sf::Uint32 request_id = make_request_id();
+
+	sf::Packet request;
+
+	request << CHECK_VERSION << request_id << WIRE_VERSION;
+
+	/*
+	 * Requests may follow right away, the server handles them in order after the check.
+	 */
+	submit(request_id, request, ReplyHandler([this](Reader& reply) {
+			sf::Uint32 version = 0;
+
+			if (!reply.EndOfData())
+				reply >> version;
+
+			if (version != WIRE_VERSION) {
+				LOG_DEBUG("Voodoo::Client::check_version() server has wire format version %u\n", version);
+
+				channel->Shutdown();
+			}
+		}));
+}
+
+sf::Uint32 Client::make_request_id()
+{
+	std::unique_lock<std::mutex> l(lock);
+
+	if (++request_ids == 0)
+		++request_ids;
+
+	return request_ids;
+}
+
+void Client::submit(sf::Uint32 request_id, sf::Packet& request, Completion completion, const std::vector<Data>& blobs)
+{
+	submit(request_id, request, ReplyHandler([completion](Reader& reply) {
+			std::vector<std::any> result;
+
+			get_values(reply, result);
+
+			completion(result);
+		}), blobs);
+}
+
+void Client::submit(sf::Uint32 request_id, sf::Packet& request, ReplyHandler handler, const std::vector<Data>& blobs)
+{
+	std::unique_lock<std::mutex> l(lock);
+
+	if (!running)
+		throw std::runtime_error("client not connected");
+
+	/*
+	 * Add pending request before sending, as the reply may arrive before send() returns.
+	 */
+	pending[request_id] = handler;
+
+	l.unlock();
+
+
+	try {
+		send(request, blobs);
+	}
+	catch (...) {
+		l.lock();
+
+		pending.erase(request_id);
+
+		throw;
+	}
+}
+
+void Client::send(sf::Packet& request, const std::vector<Data>& blobs)
+{
+	std::unique_lock<std::mutex> l(send_lock);
+
+	channel->Send(request, blobs);
+}
+
+void Client::receive_replies()
+{
+	std::unique_lock<std::mutex> l(lock);
+
+	while (running) {
+		l.unlock();
+
+		std::unique_ptr<sf::Packet> packet;
+
+		switch (channel->Receive(packet, 50)) {
+		case sf::Socket::Done:
+			/*
+			 * Data values of the reply keep the packet alive.
+			 */
+			handle_reply(std::move(packet));
+			break;
+
+		case sf::Socket::NotReady:
+		case sf::Socket::Partial:
+			break;
+
+		default:
+			l.lock();
+
+			running = false;
+
+			/*
+			 * Dropping the completions breaks the promises of pending calls.
+			 */
+			pending.clear();
+
+			return;
+		}
+
+		l.lock();
+	}
+}
+
+void Client::handle_reply(std::shared_ptr<sf::Packet> packet)
+{
+	sf::Uint32 request_id;
+
+	if (!(*packet >> request_id)) {
+		LOG_DEBUG("Voodoo::Client::handle_reply() invalid reply\n");
+		return;
+	}
+
+	if (!request_id) {
+		handle_call(packet);
+		return;
+	}
+
+	std::unique_lock<std::mutex> l(lock);
+
+	auto it = pending.find(request_id);
+
+	if (it == pending.end()) {
+		LOG_DEBUG("Voodoo::Client::handle_reply() invalid request id %u\n", request_id);
+		return;
+	}
+
+	ReplyHandler handler = it->second;
+
+	pending.erase(it);
+
+	l.unlock();
+
+
+	Reader reply(packet, sizeof(request_id));
+
+	handler(reply);
+}
+
+void Client::handle_call(std::shared_ptr<sf::Packet> packet)
+{
+	ID method_id;
+	sf::Uint32 request_id;
+
+	if (!(*packet >> method_id >> request_id)) {
+		LOG_DEBUG("Voodoo::Client::handle_call() invalid call\n");
+		return;
+	}
+
+	LOG_DEBUG("Voodoo::Client::handle_call(%zu, [%llu], #%u)\n", packet->getDataSize(), *method_id, request_id);
+
+	Reader reader(packet, sizeof(sf::Uint32) + sizeof(ID) + sizeof(request_id));
+
+	sf::Packet reply;
+
+	reply << ID() << request_id;
+
+	/*
+	 * The server must not be able to terminate the receiver.
+	 */
+	try {
+		Handle(method_id, reader, request_id ? &reply : NULL);
+	}
+	catch (std::runtime_error& e) {
+		LOG_DEBUG("Voodoo::Client::handle_call() %s\n", e.what());
+
+		/*
+		 * Reply without values, so the server does not wait forever.
+		 */
+		reply.clear();
+		reply << ID() << request_id;
+	}
+
+	if (!request_id)
+		return;
+
+	try {
+		send(reply);
+	}
+	catch (std::runtime_error& e) {
+		LOG_DEBUG("Voodoo::Client::handle_call() %s\n", e.what());
+	}
 }
 
 
@@ -463,7 +3546,7 @@ InterfaceClient::InterfaceClient(Client& client, ID method_id)
 
 InterfaceClient::~InterfaceClient()
 {
-	client.Call(method_id, (int)RELEASE);
+	client.Post(method_id, (int)RELEASE);
 }
 
 ID InterfaceClient::GetMethodID() const
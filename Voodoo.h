@@ -3,10 +3,23 @@
 #include <assert.h>
 
 #include <any>
+#include <array>
+#include <atomic>
+#include <bitset>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <functional>
+#include <future>
+#include <list>
+#include <map>
+#include <memory>
 #include <mutex>
+#include <shared_mutex>
 #include <stdexcept>
 #include <thread>
+#include <tuple>
+#include <type_traits>
 
 #include <SFML/Network.hpp>
 
@@ -32,6 +45,11 @@ public:
 		return value < other.value;
 	}
 
+	bool operator ==(const ID& other) const
+	{
+		return value == other.value;
+	}
+
 	bool operator !=(const ID& other) const
 	{
 		return value != other.value;
@@ -50,6 +68,18 @@ sf::Packet& operator >>(sf::Packet& packet, ID& id);
 
 /*
  * Packet class holding our value type definition
+ *
+ * Each value is sent as a one byte type followed by the value. 8 bit integers and floats are
+ * sent as is, larger integers and IDs as variable length integers (7 bits per byte, least
+ * significant first), signed ones zigzag encoded. Strings and data have a variable length size.
+ * Arguments of typed calls are sent without types after a single UNTAGGED, replies and command
+ * buffers keep the types.
+ *
+ * This is version 2 of the format, which is not compatible with version 1 (four byte types and
+ * fixed size integers). There is no fallback to version 1, clients and servers have to be updated
+ * together. Clients send their version as the first request, servers reject version 1 clients
+ * (sending no version) by shutting their connection down. Clients shut down the connection if the
+ * server does not reply with version 2, which may be after some requests were sent already.
  */
 class Packet
 {
@@ -70,11 +100,190 @@ public:
 		FLOAT32,
 		FLOAT64,
 		STRING,
-		DATA
+		DATA,		// length followed by the bytes, may appear anywhere and any number of times
+
+		UNTAGGED = 0xff	// typed call, the following values are sent without type
 	} ValueType;
 };
 
 
+/*
+ * Append variable length integer.
+ */
+inline void put_varint(sf::Packet& packet, sf::Uint64 value)
+{
+	sf::Uint8 bytes[10];
+	size_t length = 0;
+
+	while (value >= 0x80) {
+		bytes[length++] = (sf::Uint8)(value | 0x80);
+		value >>= 7;
+	}
+
+	bytes[length++] = (sf::Uint8)value;
+
+	packet.append(bytes, length);
+}
+
+/*
+ * Append signed variable length integer, small negative values being short as well.
+ */
+inline void put_zigzag(sf::Packet& packet, sf::Int64 value)
+{
+	put_varint(packet, ((sf::Uint64)value << 1) ^ (sf::Uint64)(value >> 63));
+}
+
+/*
+ * Append type and length of a DATA value, the bytes have to follow.
+ */
+inline void put_data_prefix(sf::Packet& packet, size_t length)
+{
+	packet << (sf::Uint8)Packet::DATA;
+
+	put_varint(packet, length);
+}
+
+
+/*
+ * View of contiguous memory not owned by the span, like std::span (C++20)
+ */
+template <typename T>
+class Span
+{
+private:
+	T* ptr;
+	size_t count;
+
+public:
+	Span() : ptr(NULL), count(0) {}
+	Span(T* ptr, size_t count) : ptr(ptr), count(count) {}
+
+	T* data() const { return ptr; }
+	size_t size() const { return count; }
+	size_t size_bytes() const { return count * sizeof(T); }
+	bool empty() const { return count == 0; }
+
+	T* begin() const { return ptr; }
+	T* end() const { return ptr + count; }
+
+	T& operator[](size_t index) const
+	{
+		return ptr[index];
+	}
+};
+
+/*
+ * Value of type DATA, i.e. a length-prefixed blob
+ *
+ * Received values point into the packet, which is kept alive by the owner (if any),
+ * otherwise they are only valid while the handler runs.
+ */
+class Data : public Span<const sf::Uint8>
+{
+private:
+	std::shared_ptr<const void> owner;
+
+public:
+	Data() {}
+	Data(const void* ptr, size_t size, std::shared_ptr<const void> owner = nullptr)
+		:
+		Span((const sf::Uint8*)ptr, size),
+		owner(owner)
+	{
+	}
+};
+
+
+/*
+ * Reader for values of a received packet
+ *
+ * Values are decoded like sf::Packet does, but the position is known exactly,
+ * so that data blobs can be returned as spans and skipped without copying.
+ * Reading beyond the end throws std::runtime_error.
+ */
+class Reader
+{
+private:
+	const sf::Uint8* data;
+	size_t size;
+	size_t position;
+	std::shared_ptr<const void> owner;
+	bool tagged;	// values have types, unless a typed call left them out
+
+public:
+	Reader(const void* data, size_t size, std::shared_ptr<const void> owner = nullptr);
+	Reader(const sf::Packet& packet, size_t position = 0);
+
+	/*
+	 * Read from a packet being kept alive by data values read from it.
+	 */
+	Reader(std::shared_ptr<const sf::Packet> packet, size_t position = 0);
+
+	bool EndOfData() const;
+	size_t GetPosition() const;
+
+	bool IsTagged() const;
+	void SetTagged(bool tagged);
+
+	Reader& operator >>(sf::Int8& value);
+	Reader& operator >>(sf::Uint8& value);
+	Reader& operator >>(sf::Int16& value);
+	Reader& operator >>(sf::Uint16& value);
+	Reader& operator >>(sf::Int32& value);
+	Reader& operator >>(sf::Uint32& value);
+	Reader& operator >>(sf::Int64& value);
+	Reader& operator >>(sf::Uint64& value);
+	Reader& operator >>(float& value);
+	Reader& operator >>(double& value);
+	Reader& operator >>(std::string& value);
+	Reader& operator >>(ID& value);
+
+	/*
+	 * Read variable length integers, see put_varint and put_zigzag.
+	 */
+	sf::Uint64 ReadVarint();
+	sf::Int64 ReadZigZag();
+
+	/*
+	 * Read a data blob of the given length without copying.
+	 */
+	Data ReadData(size_t length);
+
+private:
+	const sf::Uint8* take(size_t length);
+};
+
+
+/*
+ * Typed method ID, the signature defines argument and result types, e.g. Method<sf::Int64(int, int)>
+ *
+ * Calls to typed methods are marshalled at compile time, see Marshal.
+ */
+template <typename Signature>
+class Method;
+
+template <typename R, typename... Args>
+class Method<R(Args...)>
+{
+private:
+	ID id;
+
+public:
+	Method() {}
+	explicit Method(ID id) : id(id) {}
+
+	ID GetID() const
+	{
+		return id;
+	}
+};
+
+
+template <typename Signature>
+class Marshal;
+
+template <typename IFace>
+class InterfaceServer;
 
 
 /*
@@ -82,23 +291,92 @@ public:
  */
 class Host
 {
+public:
+	/*
+	 * Flags for registered methods
+	 */
+	typedef enum {
+		NONE   = 0,
+		ONEWAY = 1	// result is discarded and no reply values are sent, see Client::Post
+	} MethodFlags;
+
+	/*
+	 * Handler for decoding arguments from the request and encoding the result to the reply (NULL if not wanted).
+	 */
+	typedef std::function<void(Reader& request, sf::Packet* reply)> Decoder;
+
+	/*
+	 * Plain function being called with the context it was registered with, see RegisterInvoker.
+	 */
+	typedef void (*Invoker)(void* context, Reader& request, sf::Packet* reply);
+
 private:
-	unsigned long long ids;
-	std::map<ID, std::function<std::any(std::vector<std::any>)>> methods;
-	std::map<ID, void*> interfaces;
+	class Entry
+	{
+	public:
+		std::function<std::any(std::vector<std::any>)> handler;
+		Decoder decoder;	// set for typed methods instead of handler
+		Invoker invoker;	// set for methods registered with a plain function
+		void* context;
+		MethodFlags flags;
+	};
+
+	/*
+	 * Registry slot, IDs hold the slot index in the lower and the generation in the upper 32 bits.
+	 *
+	 * The generation is incremented whenever a slot is released, so stale IDs do not match anymore.
+	 */
+	class Slot
+	{
+	public:
+		std::shared_ptr<const Entry> method;
+		void* _interface;
+		sf::Uint32 generation;
+		bool used;
+	};
+
+	std::shared_mutex lock;
+	std::vector<Slot> slots;
+	std::vector<sf::Uint32> free_slots;
 
 public:
 	Host();
 
 	/*
 	 * Generate a new ID for usage as method, interface or cleanup handler ID
+	 *
+	 * The ID is released when neither a method nor an interface is registered with it anymore.
 	 */
 	ID MakeID();
 
 	/*
 	 * Register method for incoming calls. Generates a new ID using MakeID.
+	 *
+	 * Handlers of methods without result may return an empty std::any.
+	 */
+	ID Register(std::function<std::any(std::vector<std::any>)> handler, MethodFlags flags = NONE);
+
+	/*
+	 * Register typed method for incoming calls, e.g. Register<sf::Int64(int, int)>(handler).
+	 *
+	 * Arguments are decoded straight into a tuple for calling the handler, no std::any is involved.
+	 */
+	template <typename Signature, typename Handler>
+	Method<Signature> Register(Handler handler, MethodFlags flags = NONE)
+	{
+		return Method<Signature>(RegisterDecoder(Marshal<Signature>::MakeDecoder(handler), flags));
+	}
+
+	/*
+	 * Register method decoding the request itself.
+	 */
+	ID RegisterDecoder(Decoder decoder, MethodFlags flags = NONE);
+
+	/*
+	 * Register method decoding the request itself, being called via plain function pointer.
 	 */
-	ID Register(std::function<std::any(std::vector<std::any>)> handler);
+	ID RegisterInvoker(Invoker invoker, void* context, MethodFlags flags = NONE);
+
 	void Unregister(ID id);
 
 	/*
@@ -109,237 +387,1847 @@ public:
 	void* LookupInterface(ID id);
 
 	/*
-	 * Handle incoming call based on method ID.
+	 * Handle incoming call based on method ID. Returns an empty std::any for one-way methods.
+	 *
+	 * The handler is called without holding the lock, so it may (un)register methods and interfaces.
 	 */
 	std::any Handle(ID id, std::vector<std::any> args);
 
+	/*
+	 * Handle incoming call reading the arguments from the request and appending the result to the reply.
+	 *
+	 * The reply is NULL if no result is wanted.
+	 */
+	void Handle(ID id, Reader& request, sf::Packet* reply);
+
 protected:
+	friend class CommandBuffer;
+
+	template <typename Signature>
+	friend class Marshal;
+
+	template <typename IFace>
+	friend class InterfaceServer;
+
 	/*
 	 * Template function for data being appended to a packet
 	 *
 	 * Specializations will write type and value accordingly
 	 */
 	template <typename T>
-	void put_arg(sf::Packet& packet, T arg);
+	static void put_arg(sf::Packet& packet, T arg);
+
+	/*
+	 * Template function for data being appended to a packet without type, see Marshal::Encode
+	 */
+	template <typename T>
+	static void put_value(sf::Packet& packet, T arg);
+
+	/*
+	 * Template function for data being read from a packet
+	 *
+	 * Specializations will check type and read value accordingly
+	 */
+	template <typename T>
+	static void get_arg(Reader& reader, T& arg);
 
 	/*
 	 * Append data to a packet.
 	 */
-	void any_to_packet(std::any value, sf::Packet& packet);
+	static void any_to_packet(std::any value, sf::Packet& packet);
 
 	/*
 	 * Get data from a packet.
 	 */
-	void get_values(sf::Packet& packet, std::vector<std::any>& values, size_t readStart = 0);
+	static void get_values(Reader& reader, std::vector<std::any>& values);
+
+private:
+	/*
+	 * Return the slot of the ID or NULL if invalid or stale, the lock has to be held.
+	 */
+	Slot* find_slot(ID id);
+
+	/*
+	 * Release the slot if nothing is registered anymore, the lock has to be held.
+	 */
+	void release_slot(ID id);
+
+	ID register_entry(std::shared_ptr<const Entry> entry);
+
+	/*
+	 * Return the method of the ID, throws if invalid or stale.
+	 */
+	std::shared_ptr<const Entry> lookup(ID id);
 
 };
 
 
+template <>
+inline void Host::put_value(sf::Packet& packet, ID arg)
+{
+	put_varint(packet, *arg);
+}
+
 template <>
 inline void Host::put_arg(sf::Packet& packet, ID arg)
 {
-	packet << Packet::ID;
+	packet << (sf::Uint8)Packet::ID;
+	put_value(packet, arg);
+}
+
+template <>
+inline void Host::put_value(sf::Packet& packet, sf::Int8 arg)
+{
 	packet << arg;
 }
 
 template <>
 inline void Host::put_arg(sf::Packet& packet, sf::Int8 arg)
 {
-	packet << Packet::INT8;
+	packet << (sf::Uint8)Packet::INT8;
+	put_value(packet, arg);
+}
+
+template <>
+inline void Host::put_value(sf::Packet& packet, sf::Uint8 arg)
+{
 	packet << arg;
 }
 
 template <>
 inline void Host::put_arg(sf::Packet& packet, sf::Uint8 arg)
 {
-	packet << Packet::UINT8;
-	packet << arg;
+	packet << (sf::Uint8)Packet::UINT8;
+	put_value(packet, arg);
+}
+
+template <>
+inline void Host::put_value(sf::Packet& packet, sf::Int16 arg)
+{
+	put_zigzag(packet, arg);
 }
 
 template <>
 inline void Host::put_arg(sf::Packet& packet, sf::Int16 arg)
 {
-	packet << Packet::INT16;
-	packet << arg;
+	packet << (sf::Uint8)Packet::INT16;
+	put_value(packet, arg);
+}
+
+template <>
+inline void Host::put_value(sf::Packet& packet, sf::Uint16 arg)
+{
+	put_varint(packet, arg);
 }
 
 template <>
 inline void Host::put_arg(sf::Packet& packet, sf::Uint16 arg)
 {
-	packet << Packet::UINT16;
-	packet << arg;
+	packet << (sf::Uint8)Packet::UINT16;
+	put_value(packet, arg);
+}
+
+template <>
+inline void Host::put_value(sf::Packet& packet, sf::Int32 arg)
+{
+	put_zigzag(packet, arg);
 }
 
 template <>
 inline void Host::put_arg(sf::Packet& packet, sf::Int32 arg)
 {
-	packet << Packet::INT32;
-	packet << arg;
+	packet << (sf::Uint8)Packet::INT32;
+	put_value(packet, arg);
+}
+
+template <>
+inline void Host::put_value(sf::Packet& packet, sf::Uint32 arg)
+{
+	put_varint(packet, arg);
 }
 
 template <>
 inline void Host::put_arg(sf::Packet& packet, sf::Uint32 arg)
 {
-	packet << Packet::UINT32;
-	packet << arg;
+	packet << (sf::Uint8)Packet::UINT32;
+	put_value(packet, arg);
+}
+
+template <>
+inline void Host::put_value(sf::Packet& packet, sf::Int64 arg)
+{
+	put_zigzag(packet, arg);
 }
 
 template <>
 inline void Host::put_arg(sf::Packet& packet, sf::Int64 arg)
 {
-	packet << Packet::INT64;
-	packet << arg;
+	packet << (sf::Uint8)Packet::INT64;
+	put_value(packet, arg);
+}
+
+template <>
+inline void Host::put_value(sf::Packet& packet, sf::Uint64 arg)
+{
+	put_varint(packet, arg);
 }
 
 template <>
 inline void Host::put_arg(sf::Packet& packet, sf::Uint64 arg)
 {
-	packet << Packet::UINT64;
-	packet << arg;
+	packet << (sf::Uint8)Packet::UINT64;
+	put_value(packet, arg);
+}
+
+template <>
+inline void Host::put_value(sf::Packet& packet, unsigned long arg)	// FIXME: check i386 case
+{
+	put_varint(packet, (sf::Uint64)arg);
 }
 
 template <>
 inline void Host::put_arg(sf::Packet& packet, unsigned long arg)	// FIXME: check i386 case
 {
-	packet << Packet::UINT64;
-	packet << (sf::Uint64)arg;
+	packet << (sf::Uint8)Packet::UINT64;
+	put_value(packet, arg);
 }
 
 template <>
-inline void Host::put_arg(sf::Packet& packet, float arg)
+inline void Host::put_value(sf::Packet& packet, float arg)
 {
-	packet << Packet::FLOAT32;
 	packet << arg;
 }
 
 template <>
-inline void Host::put_arg(sf::Packet& packet, double arg)
+inline void Host::put_arg(sf::Packet& packet, float arg)
 {
-	packet << Packet::FLOAT64;
-	packet << arg;
+	packet << (sf::Uint8)Packet::FLOAT32;
+	put_value(packet, arg);
 }
 
 template <>
-inline void Host::put_arg(sf::Packet& packet, std::string arg)
+inline void Host::put_value(sf::Packet& packet, double arg)
 {
-	packet << Packet::STRING;
 	packet << arg;
 }
 
+template <>
+inline void Host::put_arg(sf::Packet& packet, double arg)
+{
+	packet << (sf::Uint8)Packet::FLOAT64;
+	put_value(packet, arg);
+}
 
-/*
- * Server class for running the service on a TCP socket.
- */
-class Server : public Host
+template <>
+inline void Host::put_value(sf::Packet& packet, std::string arg)
 {
-private:
-	std::mutex lock;
-	sf::TcpListener listener;
-	sf::SocketSelector selector;
-	std::thread *acceptor;
-	std::vector<sf::TcpSocket*> clients;
-	bool running;
-	static thread_local sf::TcpSocket* current_client;
+	put_varint(packet, arg.size());
+	packet.append(arg.data(), arg.size());
+}
 
-	typedef std::function<void(void)> CleanupHandler;
-	std::map<sf::TcpSocket*, std::map<ID,CleanupHandler>> cleanups;
+template <>
+inline void Host::put_arg(sf::Packet& packet, std::string arg)
+{
+	packet << (sf::Uint8)Packet::STRING;
+	put_value(packet, arg);
+}
 
-public:
-	Server();
-	~Server() noexcept(false);
+template <>
+inline void Host::put_value(sf::Packet& packet, Data arg)
+{
+	put_varint(packet, arg.size());
+	packet.append(arg.data(), arg.size());
+}
 
-	/*
-	 * Put server socket in listening mode and accept incoming connections in a thread.
-	 */
-	void Listen(int port = 5000);
+template <>
+inline void Host::put_arg(sf::Packet& packet, Data arg)
+{
+	put_data_prefix(packet, arg.size());
+	packet.append(arg.data(), arg.size());
+}
 
-	/*
-	 * Handle incoming calls on any connection.
-	 */
-	void Run();
 
-	/*
-	 * Stop accepting new connections.
-	 */
-	void Stop();
+/*
+ * Read and check the type of the next value in a packet.
+ *
+ * Typed calls start with Packet::UNTAGGED instead, the reader does not expect types after it.
+ */
+inline void check_type(Reader& reader, Packet::ValueType type)
+{
+	if (!reader.IsTagged())
+		return;
 
-	/*
-	 * Register cleanup handler for the current client being handled.
-	 */
-	void PushCleanup(ID cleanup_id, CleanupHandler handler);
-	void RemoveCleanup(ID cleanup_id);
+	sf::Uint8 t;
 
-private:
-	/*
-	 * Run cleanup handlers for the specified socket.
-	 */
-	void cleanup(sf::TcpSocket* socket);
+	reader >> t;
 
-private:
-	/*
-	 * Handle request (incoming call) and fill packet for reply.
-	 */
-	void dispatch(sf::Packet& request, sf::Packet& reply);
-};
+	if (t == Packet::UNTAGGED) {
+		reader.SetTagged(false);
+		return;
+	}
 
+	if (t != type)
+		throw std::runtime_error("argument type mismatch");
+}
 
 /*
- * Client class for using the service via TCP socket.
+ * Convert a variable length integer to the type of the argument, throws if out of range.
  */
-class Client : public Host
+template <typename T, typename V>
+inline T narrow_integer(V value)
 {
-private:
-	sf::TcpSocket socket;
+	T result = (T)value;
 
-public:
+	if ((V)result != value)
+		throw std::runtime_error("argument out of range");
+
+	return result;
+}
+
+template <>
+inline void Host::get_arg(Reader& reader, ID& arg)
+{
+	check_type(reader, Packet::ID);
+	arg = ID(reader.ReadVarint());
+}
+
+template <>
+inline void Host::get_arg(Reader& reader, sf::Int8& arg)
+{
+	check_type(reader, Packet::INT8);
+	reader >> arg;
+}
+
+template <>
+inline void Host::get_arg(Reader& reader, sf::Uint8& arg)
+{
+	check_type(reader, Packet::UINT8);
+	reader >> arg;
+}
+
+template <>
+inline void Host::get_arg(Reader& reader, sf::Int16& arg)
+{
+	check_type(reader, Packet::INT16);
+	arg = narrow_integer<sf::Int16>(reader.ReadZigZag());
+}
+
+template <>
+inline void Host::get_arg(Reader& reader, sf::Uint16& arg)
+{
+	check_type(reader, Packet::UINT16);
+	arg = narrow_integer<sf::Uint16>(reader.ReadVarint());
+}
+
+template <>
+inline void Host::get_arg(Reader& reader, sf::Int32& arg)
+{
+	check_type(reader, Packet::INT32);
+	arg = narrow_integer<sf::Int32>(reader.ReadZigZag());
+}
+
+template <>
+inline void Host::get_arg(Reader& reader, sf::Uint32& arg)
+{
+	check_type(reader, Packet::UINT32);
+	arg = narrow_integer<sf::Uint32>(reader.ReadVarint());
+}
+
+template <>
+inline void Host::get_arg(Reader& reader, sf::Int64& arg)
+{
+	check_type(reader, Packet::INT64);
+	arg = reader.ReadZigZag();
+}
+
+template <>
+inline void Host::get_arg(Reader& reader, sf::Uint64& arg)
+{
+	check_type(reader, Packet::UINT64);
+	arg = reader.ReadVarint();
+}
+
+template <>
+inline void Host::get_arg(Reader& reader, unsigned long& arg)	// FIXME: check i386 case
+{
+	check_type(reader, Packet::UINT64);
+	arg = narrow_integer<unsigned long>(reader.ReadVarint());
+}
+
+template <>
+inline void Host::get_arg(Reader& reader, float& arg)
+{
+	check_type(reader, Packet::FLOAT32);
+	reader >> arg;
+}
+
+template <>
+inline void Host::get_arg(Reader& reader, double& arg)
+{
+	check_type(reader, Packet::FLOAT64);
+	reader >> arg;
+}
+
+template <>
+inline void Host::get_arg(Reader& reader, std::string& arg)
+{
+	check_type(reader, Packet::STRING);
+	Data data = reader.ReadData(reader.ReadVarint());
+
+	arg.assign((const char*)data.data(), data.size());
+}
+
+template <>
+inline void Host::get_arg(Reader& reader, Data& arg)
+{
+	check_type(reader, Packet::DATA);
+	arg = reader.ReadData(reader.ReadVarint());
+}
+
+
+/*
+ * Marshalling of typed method calls, generated at compile time from the signature
+ */
+template <typename R, typename... Args>
+class Marshal<R(Args...)>
+{
+public:
+	/*
+	 * Method type for calling this signature on an interface (method of interface API being prepended).
+	 */
+	typedef Method<R(int, Args...)> InterfaceMethod;
+
+	/*
+	 * Append arguments to the request, converting them to the types of the signature.
+	 *
+	 * As both ends know the types, they are left out (Packet::UNTAGGED). The receiving method
+	 * has to be typed as well, untyped handlers can not decode such calls.
+	 */
+	template <typename... Params>
+	static void Encode(sf::Packet& request, Params&&... params)
+	{
+		static_assert(sizeof...(Params) == sizeof...(Args), "wrong number of arguments");
+
+		if constexpr (sizeof...(Args) > 0)
+			request << (sf::Uint8)Packet::UNTAGGED;
+
+		(Host::put_value<std::decay_t<Args>>(request, std::decay_t<Args>(std::forward<Params>(params))), ...);
+	}
+
+	/*
+	 * Read arguments from the request.
+	 */
+	static std::tuple<std::decay_t<Args>...> Decode(Reader& request)
+	{
+		std::tuple<std::decay_t<Args>...> args;
+
+		std::apply([&request](auto&... arg) {
+				(Host::get_arg(request, arg), ...);
+			}, args);
+
+		return args;
+	}
+
+	/*
+	 * Read result from the reply.
+	 */
+	static R DecodeResult(Reader& reply)
+	{
+		if constexpr (!std::is_void_v<R>) {
+			std::decay_t<R> result{};
+
+			Host::get_arg(reply, result);
+
+			return result;
+		}
+	}
+
+	/*
+	 * Make a decoder calling the handler with the decoded arguments and encoding its result.
+	 */
+	template <typename Handler>
+	static Host::Decoder MakeDecoder(Handler handler)
+	{
+		return [handler](Reader& request, sf::Packet* reply) {
+				Invoke(handler, request, reply);
+			};
+	}
+
+	/*
+	 * Call the handler with the decoded arguments and encode its result.
+	 */
+	template <typename Handler>
+	static void Invoke(const Handler& handler, Reader& request, sf::Packet* reply)
+	{
+		auto args = Decode(request);
+
+		if constexpr (std::is_void_v<R>)
+			std::apply(handler, std::move(args));
+		else {
+			std::decay_t<R> result = std::apply(handler, std::move(args));
+
+			if (reply)
+				Host::put_arg<std::decay_t<R>>(*reply, result);
+		}
+	}
+};
+
+
+/*
+ * Arguments of a typed call being encoded once, e.g. for posting the same call to many clients.
+ *
+ * The encoded arguments are immutable and shared by all copies and pending sends, see Server::Post.
+ */
+template <typename Signature>
+class Message;
+
+template <typename R, typename... Args>
+class Message<R(Args...)>
+{
+private:
+	std::shared_ptr<const sf::Packet> packet;
+
+	friend class Server;
+
+public:
+	explicit Message(const std::decay_t<Args>&... args)
+	{
+		auto encoded = std::make_shared<sf::Packet>();
+
+		Marshal<R(Args...)>::Encode(*encoded, args...);
+
+		packet = std::move(encoded);
+	}
+};
+
+
+/*
+ * Class and signature of a member function, e.g. for sf::Int64 (Clock::*)(int) being Clock and sf::Int64(int)
+ */
+template <typename Member>
+class MemberFunction;
+
+template <typename C, typename R, typename... Args>
+class MemberFunction<R (C::*)(Args...)>
+{
+public:
+	typedef C Class;
+	typedef R Result;
+	using Signature = R(Args...);
+
+	/*
+	 * Member function taking the values of the call as a vector (like handlers returned by Lookup)
+	 */
+	static constexpr bool dynamic = std::is_same_v<std::tuple<std::decay_t<Args>...>, std::tuple<std::vector<std::any>>>;
+};
+
+template <typename C, typename R, typename... Args>
+class MemberFunction<R (C::*)(Args...) const> : public MemberFunction<R (C::*)(Args...)>
+{
+};
+
+
+/*
+ * Command buffer for recording calls to be submitted as a single data buffer.
+ *
+ * Each recorded command is prefixed by its size and holds the values of one call,
+ * e.g. the interface method followed by its arguments.
+ */
+class CommandBuffer
+{
+private:
+	sf::Packet buffer;
+	size_t count;
+
+public:
+	CommandBuffer();
+
+	/*
+	 * Record a command with the given values.
+	 */
+	template <typename... Args>
+	void Record(Args&&... args)
+	{
+		sf::Packet command;
+
+		(Host::put_arg(command, std::forward<Args>(args)), ...);
+
+		append(command);
+	}
+
+	/*
+	 * Record a command with the given values and data buffer.
+	 */
+	template <typename... Args>
+	void Record2(const void* ptr, size_t length, Args&&... args)
+	{
+		sf::Packet command;
+
+		(Host::put_arg(command, std::forward<Args>(args)), ...);
+
+		Host::put_arg(command, Data(ptr, length));
+
+		append(command);
+	}
+
+	/*
+	 * Remove all recorded commands.
+	 */
+	void Clear();
+
+	bool Empty() const;
+	size_t GetCount() const;
+	const void* GetData() const;
+	size_t GetSize() const;
+
+	/*
+	 * Decode all commands from a submitted buffer and call the handler for each one.
+	 */
+	static void Execute(const void* data, size_t size, std::function<void(std::vector<std::any>)> handler);
+
+	/*
+	 * Decode the method of all commands from a submitted buffer and call the handler for decoding the arguments.
+	 *
+	 * Each command has to start with an int (the method), the reader is positioned behind it.
+	 */
+	static void Execute(const void* data, size_t size, std::function<void(int method, Reader& command)> handler);
+
+private:
+	void append(sf::Packet& command);
+
+	/*
+	 * Split a submitted buffer into commands.
+	 */
+	static void split(const void* data, size_t size, std::function<void(Reader& command)> handler);
+};
+
+
+/*
+ * Event loop waiting for readiness of non-blocking sockets.
+ *
+ * On Linux this uses epoll, so the work per wakeup only depends on the number of
+ * ready sockets. Other platforms fall back to polling a SocketSelector.
+ */
+class Reactor
+{
+public:
+	typedef enum {
+		READ   = 1,
+		WRITE  = 2,
+		HANGUP = 4		// peer closed its end, reported in addition to READ
+	} Events;
+
+	class Event
+	{
+	public:
+		void* context;
+		int events;
+	};
+
+private:
+#ifdef __linux__
+	int epoll_fd;
+	int event_fd;
+	std::vector<Event>* batch;	// events of the last Wait(), see Remove()
+#else
+	class Source
+	{
+	public:
+		sf::Socket* socket;
+		int events;
+	};
+
+	std::mutex lock;
+	sf::SocketSelector selector;
+	std::map<void*, Source> sources;
+#endif
+
+public:
+	Reactor();
+	~Reactor();
+
+	/*
+	 * Add socket with context being returned in events.
+	 *
+	 * Removing drops events of the context not handled yet since the last Wait(), in case
+	 * it is registered with more than one file descriptor.
+	 */
+	void Add(sf::Socket& socket, void* context, int events);
+	void Modify(sf::Socket& socket, void* context, int events);
+	void Remove(sf::Socket& socket, void* context);
+
+#ifdef __linux__
+	/*
+	 * Add file descriptor (e.g. Unix domain socket or eventfd) with context being returned in events.
+	 */
+	void Add(int fd, void* context, int events);
+	void Modify(int fd, void* context, int events);
+	void Remove(int fd, void* context);
+#endif
+
+	/*
+	 * Wait for ready sockets, Wake() being called or the timeout (unless negative), events are replaced.
+	 */
+	void Wait(std::vector<Event>& events, int timeout_ms = -1);
+
+	/*
+	 * Interrupt Wait() from another thread.
+	 */
+	void Wake();
+};
+
+
+/*
+ * Transport of packets for one connection between client and server.
+ *
+ * On the server, channels are created by a Listener, never block and are driven by the
+ * Reactor of the server: Watch() registers them, events are passed to Prepare() before
+ * replies are flushed and requests received. On the client, channels block and are used
+ * by the sending threads and the receiver thread of the Client.
+ *
+ * Packets are framed like sf::Packet does on TCP (size in network byte order).
+ */
+class Channel
+{
+protected:
+	Reactor* reactor;	// server side, set by Watch()
+	void* context;
+
+public:
+	Channel() : reactor(NULL), context(NULL) {}
+	virtual ~Channel() {}
+
+	/*
+	 * Server side: add to reactor reporting events with the context, or remove.
+	 */
+	virtual void Watch(Reactor& reactor, void* context);
+	virtual void Unwatch() = 0;
+
+	/*
+	 * Server side: prepare for flushing and receiving after the reactor reported events.
+	 *
+	 * Returns NotReady while the connection is not set up completely (e.g. handshake pending).
+	 */
+	virtual sf::Socket::Status Prepare(int events);
+
+	/*
+	 * Receive packet, waiting up to the timeout for it (client side only).
+	 *
+	 * Partially received packets are kept until complete. Channels framing packets themselves
+	 * return Error for packets larger than 256 MiB.
+	 */
+	virtual sf::Socket::Status Receive(std::unique_ptr<sf::Packet>& packet, int timeout_ms = 0) = 0;
+
+	/*
+	 * Server side: send without blocking, the body (unless NULL) following the head in the same packet.
+	 *
+	 * On NotReady or Partial the same packets have to be passed again after being woken. Both are
+	 * only read, so one body may be sent by many channels at once.
+	 */
+	virtual sf::Socket::Status Send(const sf::Packet& head, const sf::Packet* body) = 0;
+
+	/*
+	 * Server side: enable or disable WRITE events while packets are waiting to be sent.
+	 *
+	 * Channels waking the server otherwise when there is space again do nothing.
+	 */
+	virtual void WaitWritable(bool enable);
+
+	/*
+	 * Server side: shut down the connection, so that the reactor reports it as hung up.
+	 *
+	 * Channels not queueing any replies do nothing.
+	 */
+	virtual void Shutdown();
+
+	/*
+	 * Client side: send request followed by the data buffers as DATA values, blocking until sent.
+	 *
+	 * Throws std::runtime_error if the request could not be sent.
+	 */
+	virtual void Send(sf::Packet& request, const std::vector<Data>& blobs) = 0;
+};
+
+
+/*
+ * Accepting connections on the server side.
+ */
+class Listener
+{
+protected:
+	Reactor* reactor;	// set by Watch()
+	void* context;
+
+public:
+	Listener() : reactor(NULL), context(NULL) {}
+	virtual ~Listener() {}
+
+	/*
+	 * Add to reactor reporting pending connections with the context.
+	 */
+	virtual void Watch(Reactor& reactor, void* context);
+
+	/*
+	 * Pause or resume reporting pending connections.
+	 */
+	virtual void Enable(bool enable) = 0;
+
+	/*
+	 * Accept pending connection, NULL if none is pending.
+	 *
+	 * Throws std::runtime_error if accepting failed, e.g. being out of file descriptors.
+	 */
+	virtual std::unique_ptr<Channel> Accept() = 0;
+};
+
+
+/*
+ * Channel on a TCP socket.
+ */
+class TcpChannel : public Channel
+{
+private:
+	sf::TcpSocket socket;
+	std::unique_ptr<sf::SocketSelector> selector;	// client side only
+	size_t send_offset;								// of the partially sent packet (incl. size)
+#ifdef _WIN32
+	sf::Packet sending;								// head and body, SFML keeps the state of partial sends in the packet
+#endif
+
+	friend class TcpListener;
+
+public:
+	TcpChannel() : send_offset(0) {}
+
+	/*
+	 * Client side: connect to server specified by host and port number.
+	 */
+	static std::unique_ptr<TcpChannel> Connect(std::string host, int port);
+
+	virtual void Watch(Reactor& reactor, void* context);
+	virtual void Unwatch();
+	virtual sf::Socket::Status Receive(std::unique_ptr<sf::Packet>& packet, int timeout_ms = 0);
+	virtual sf::Socket::Status Send(const sf::Packet& head, const sf::Packet* body);
+	virtual void WaitWritable(bool enable);
+	virtual void Shutdown();
+
+	/*
+	 * The data buffers are not copied, header and buffers are written with vectored sends.
+	 */
+	virtual void Send(sf::Packet& request, const std::vector<Data>& blobs);
+};
+
+class TcpListener : public Listener
+{
+private:
+	sf::TcpListener listener;
+
+public:
+	TcpListener(int port);
+
+	virtual void Watch(Reactor& reactor, void* context);
+	virtual void Enable(bool enable);
+	virtual std::unique_ptr<Channel> Accept();
+};
+
+
+#ifdef __linux__
+
+/*
+ * Channel on a Unix domain socket, for clients on the same host.
+ */
+class UnixChannel : public Channel
+{
+private:
+	int fd;
+	std::vector<sf::Uint8> buffer;	// received, not yet returned as packets
+	size_t received;
+	size_t consumed;
+	size_t send_offset;				// of the partially sent packet (incl. size)
+
+public:
+	UnixChannel(int fd);
+	~UnixChannel();
+
+	/*
+	 * Client side: connect to server listening on the socket path.
+	 */
+	static std::unique_ptr<UnixChannel> Connect(std::string path);
+
+	virtual void Watch(Reactor& reactor, void* context);
+	virtual void Unwatch();
+	virtual sf::Socket::Status Receive(std::unique_ptr<sf::Packet>& packet, int timeout_ms = 0);
+	virtual sf::Socket::Status Send(const sf::Packet& head, const sf::Packet* body);
+	virtual void WaitWritable(bool enable);
+	virtual void Shutdown();
+	virtual void Send(sf::Packet& request, const std::vector<Data>& blobs);
+};
+
+class UnixListener : public Listener
+{
+private:
+	std::string path;
+	int fd;
+
+public:
+	/*
+	 * Listen on the socket path, replacing a socket left over by a previous server.
+	 */
+	UnixListener(std::string path);
+	~UnixListener();
+
+	virtual void Watch(Reactor& reactor, void* context);
+	virtual void Enable(bool enable);
+	virtual std::unique_ptr<Channel> Accept();
+};
+
+
+/*
+ * Channel between client and server on the same host via ring buffers in shared memory.
+ *
+ * The client creates a memfd holding one ring per direction and passes it along with an
+ * eventfd to the server via a Unix domain socket, which afterwards only serves to detect
+ * disconnection. Packets are streamed through the rings, so payloads larger than a ring
+ * work as well, but are never copied by the kernel.
+ *
+ * The server waits on the eventfd in its Reactor, the client on futexes in the shared memory.
+ * Each side only wakes the other one after it announced going to sleep, so no system calls
+ * are made while both sides are busy.
+ */
+class SharedChannel : public Channel
+{
+private:
+	/*
+	 * Ring header in shared memory, positions are the number of bytes written or read so far.
+	 */
+	class Header
+	{
+	public:
+		alignas(64) std::atomic<sf::Uint64> head;		// advanced by the writer
+		std::atomic<sf::Uint32> reader_waiting;			// reader sleeps until woken (futex word)
+		alignas(64) std::atomic<sf::Uint64> tail;		// advanced by the reader
+		std::atomic<sf::Uint32> writer_waiting;			// writer sleeps until space is available
+	};
+
+	/*
+	 * Local view of one ring.
+	 *
+	 * Only the own position is trusted, the position of the peer is checked on each use.
+	 */
+	class Ring
+	{
+	public:
+		Header* header;
+		sf::Uint8* data;
+		size_t capacity;		// power of two
+		sf::Uint64 position;	// head when writing, tail when reading
+		int reader_event;		// eventfd waking the reader, -1 for futex
+		int writer_event;		// eventfd waking the writer, -1 for futex
+
+		/*
+		 * Get number of bytes that can be written.
+		 */
+		size_t Space();
+
+		/*
+		 * Copy as much as fits into the ring, returning the number of bytes written.
+		 */
+		size_t Write(const void* ptr, size_t size);
+
+		/*
+		 * Get contiguous readable bytes and release them after use.
+		 */
+		size_t Readable(const sf::Uint8** ptr);
+		void Consume(size_t size);
+
+		/*
+		 * Wake the peer if it announced going to sleep.
+		 */
+		void WakeReader();
+		void WakeWriter();
+	};
+
+	int socket_fd;
+	int event_fd;		// eventfd of the server
+	void* memory;
+	size_t memory_size;
+	Ring input;
+	Ring output;
+
+	size_t send_offset;							// of the partially sent packet (incl. size)
+	sf::Uint8 size_bytes[sizeof(sf::Uint32)];	// size of the packet being received
+	size_t size_received;
+	std::unique_ptr<sf::Packet> incoming;
+
+public:
+	SharedChannel(int socket_fd);
+	~SharedChannel();
+
+	/*
+	 * Client side: create shared memory with rings of the given size and connect to the server.
+	 */
+	static std::unique_ptr<SharedChannel> Connect(int port, size_t ring_size = 1 << 20);
+
+	virtual void Watch(Reactor& reactor, void* context);
+	virtual void Unwatch();
+
+	/*
+	 * Server side: receive and map the shared memory once sent by the client, then reset the
+	 * eventfd before looking for requests and space for replies.
+	 */
+	virtual sf::Socket::Status Prepare(int events);
+
+	/*
+	 * If nothing is left to read, the reader is marked as waiting to be woken by the writer.
+	 */
+	virtual sf::Socket::Status Receive(std::unique_ptr<sf::Packet>& packet, int timeout_ms = 0);
+
+	/*
+	 * The server is woken via eventfd once there is space in a full ring.
+	 */
+	virtual sf::Socket::Status Send(const sf::Packet& head, const sf::Packet* body);
+
+	/*
+	 * Shuts down the socket, which is watched for disconnection.
+	 */
+	virtual void Shutdown();
+
+	/*
+	 * The data buffers are copied into the ring only.
+	 */
+	virtual void Send(sf::Packet& request, const std::vector<Data>& blobs);
+
+private:
+	/*
+	 * Receive and map the shared memory if sent by the client, throws if invalid.
+	 */
+	bool attach();
+
+	/*
+	 * Map the shared memory and set up the local views of the rings.
+	 */
+	void map(int memory_fd, size_t ring_size, bool server);
+
+	/*
+	 * Receive without waiting.
+	 */
+	sf::Socket::Status receive(std::unique_ptr<sf::Packet>& packet);
+
+	/*
+	 * Server side: send without waiting, returns false if the ring is full.
+	 */
+	bool send(const sf::Packet& head, const sf::Packet* body);
+
+	/*
+	 * Client side: wait for incoming data, returns false if the server disconnected.
+	 */
+	bool wait(int timeout_ms);
+
+	/*
+	 * Client side: write all bytes, waiting for space if needed.
+	 */
+	void write(const void* ptr, size_t size);
+
+	/*
+	 * Client side: check if the server still holds its end of the socket.
+	 */
+	bool connected();
+};
+
+class SharedListener : public Listener
+{
+private:
+	int fd;
+
+public:
+	/*
+	 * The port only names the (abstract) Unix domain socket used for connecting.
+	 */
+	SharedListener(int port);
+	~SharedListener();
+
+	virtual void Watch(Reactor& reactor, void* context);
+	virtual void Enable(bool enable);
+	virtual std::unique_ptr<Channel> Accept();
+};
+
+#endif
+
+
+/*
+ * Channel to a server in the same process, see Server::ConnectLoopback().
+ *
+ * Requests are passed to the server by a function call and replies are queued in memory,
+ * so neither sockets nor system calls are involved (except for waking a sleeping receiver).
+ */
+class LoopbackChannel : public Channel
+{
+public:
+	/*
+	 * Handler for requests of the client end and for its destruction.
+	 */
+	typedef std::function<void(std::unique_ptr<sf::Packet> request)> Deliver;
+	typedef std::function<void(void)> Hangup;
+
+private:
+	/*
+	 * State shared by both ends.
+	 */
+	class Pipe
+	{
+	public:
+		std::mutex lock;
+		std::condition_variable ready;
+		std::deque<std::unique_ptr<sf::Packet>> replies;
+		Deliver deliver;
+		Hangup hangup;
+		bool closed;	// either end destroyed
+
+		Pipe() : closed(false) {}
+	};
+
+	std::shared_ptr<Pipe> pipe;
+	bool server_end;
+
+	LoopbackChannel(std::shared_ptr<Pipe> pipe, bool server_end);
+
+public:
+	~LoopbackChannel();
+
+	/*
+	 * Create server and client end, the handlers are called by the client end.
+	 */
+	static std::pair<std::unique_ptr<Channel>, std::unique_ptr<Channel>> Create(Deliver deliver, Hangup hangup);
+
+	virtual void Unwatch();
+	virtual sf::Socket::Status Receive(std::unique_ptr<sf::Packet>& packet, int timeout_ms = 0);
+	/*
+	 * Head and body are copied into one packet.
+	 */
+	virtual sf::Socket::Status Send(const sf::Packet& head, const sf::Packet* body);
+
+	/*
+	 * The request is copied once, along with the data buffers.
+	 */
+	virtual void Send(sf::Packet& request, const std::vector<Data>& blobs);
+};
+
+
+/*
+ * Server class for running the service on TCP and other transports (see Channel).
+ *
+ * Requests may be dispatched by a pool of worker threads. Requests of one connection
+ * are always handled in order and by one worker at a time, while different
+ * connections are handled in parallel.
+ *
+ * Connections are kept in a table with O(1) insertion and removal. An idle connection
+ * costs about 400 bytes in user space (Connection and TcpChannel incl. sf::TcpSocket
+ * and allocation overhead, see bench_connections in VoodooTestBench) plus the kernel
+ * socket and epoll entry, no per connection allocations are made while idle.
+ *
+ * The number of connections is limited by SetMaxConnections() and by the limit of
+ * open files (RLIMIT_NOFILE, "ulimit -n"), which has to be raised for 10k and more
+ * connections. At the limit, accepting is paused until a connection is closed, while
+ * new clients wait in the listen backlog.
+ *
+ * Connections of all transports have the same call semantics and cleanup lifecycle. The
+ * server may listen on several transports at once.
+ */
+class Server : public Host
+{
+public:
+	/*
+	 * Connected client for calls from the server to methods registered by the client, see Post().
+	 */
+	class ClientID
+	{
+	public:
+		size_t slot;		// index in connection table
+		sf::Uint64 serial;	// unique per connection, as slots are reused
+
+		ClientID() : slot(0), serial(0) {}
+	};
+
+	/*
+	 * What to do with a client not keeping up with the packets sent to it, see SetQueueLimit().
+	 */
+	typedef enum {
+		DROP_OLDEST,	// drop posted calls from the front of the queue
+		DROP_NEWEST,	// drop the posted call being sent
+		DISCONNECT		// drop the queue and close the connection
+	} OverflowPolicy;
+
+	/*
+	 * Depth of send queues and number of overflows, see GetQueueStatistics().
+	 */
+	class QueueStatistics
+	{
+	public:
+		size_t packets;			// waiting for the client to receive them
+		size_t bytes;
+		sf::Uint64 dropped;		// posted calls dropped
+		sf::Uint64 disconnects;	// connections closed (server totals only)
+
+		QueueStatistics() : packets(0), bytes(0), dropped(0), disconnects(0) {}
+	};
+
+	/*
+	 * Completion handler for calls to clients, see CallAsync.
+	 */
+	typedef std::function<void(std::vector<std::any>)> Completion;
+
+private:
+	typedef std::function<void(void)> CleanupHandler;
+	typedef std::function<void(void)> TimerHandler;
+
+	/*
+	 * Handler called periodically by Run(), see AddTimer().
+	 */
+	class Timer
+	{
+	public:
+		std::chrono::milliseconds interval;
+		std::chrono::steady_clock::time_point due;
+		TimerHandler handler;
+	};
+
+	/*
+	 * Handler for the reply of a client, read position being behind the request ID.
+	 */
+	typedef std::function<void(Reader& reply)> ReplyHandler;
+
+	/*
+	 * Packet waiting to be sent, the body may be shared with other connections (see Message).
+	 */
+	class Outgoing
+	{
+	public:
+		std::unique_ptr<sf::Packet> head;
+		std::shared_ptr<const sf::Packet> body;
+		bool posted;	// may be dropped on overflow, no one waits for it
+
+		size_t size() const
+		{
+			return head->getDataSize() + (body ? body->getDataSize() : 0);
+		}
+	};
+
+	/*
+	 * State of a client connection
+	 */
+	class Connection
+	{
+	public:
+		std::unique_ptr<Channel> channel;
+		size_t slot;	// index in connection table
+		sf::Uint64 serial;
+		bool busy;		// queued for or being handled by a worker
+		bool closed;	// disconnected while busy, the worker runs the cleanup
+
+		std::vector<std::pair<ID,CleanupHandler>> cleanups;	// in order of registration
+		std::list<std::unique_ptr<sf::Packet>> requests;		// received, waiting for a worker
+
+		std::mutex send_lock;
+		std::list<Outgoing> replies;							// waiting for the channel to become writable
+		size_t queued;											// bytes of replies
+		size_t max_queued;										// zero for no limit
+		OverflowPolicy overflow_policy;
+		bool overflowed;										// to be closed, nothing is sent anymore
+		sf::Uint64 dropped;
+
+		std::map<sf::Uint32, ReplyHandler> pending;				// calls to the client, protected by connections_lock
+
+		bool version_checked;									// first request had the version of the wire format
+
+		Connection() : slot(0), serial(0), busy(false), closed(false), queued(0), max_queued(0), overflow_policy(DROP_OLDEST), overflowed(false), dropped(0), version_checked(false) {}
+	};
+
+	std::mutex lock;
+	std::condition_variable ready;
+	std::vector<std::unique_ptr<Listener>> listeners;
+	bool accepting;
+	Reactor reactor;
+	std::vector<Connection*> clients;	// connection table indexed by slot, NULL for free slots
+	std::vector<size_t> free_slots;
+	std::mutex connections_lock;		// for changing the table, taken after lock, so that Post() does not need lock
+	std::mutex disconnect_lock;			// taken last, also with send_lock held
+	std::vector<ClientID> disconnected;	// shut down, to be closed by Run()
+	std::mutex timers_lock;				// not held while calling handlers
+	std::condition_variable timer_done;
+	std::map<ID, Timer> timers;
+	std::vector<ID> due_timers;			// used by Run() only
+	ID running_timer;					// handler being called by Run()
+	std::thread::id run_thread;
+	sf::Uint64 serials;
+	std::atomic<sf::Uint32> request_ids;
+	size_t max_queued;					// default limit of connections, protected by connections_lock
+	OverflowPolicy overflow_policy;
+	QueueStatistics closed_queues;		// drops and disconnects of closed connections, protected by connections_lock
+	size_t num_clients;
+	size_t max_clients;
+	std::deque<Connection*> queue;
+	std::vector<std::thread> workers;
+	unsigned int num_workers;
+	bool running;
+	static thread_local Connection* current_client;
+
+public:
+	/*
+	 * Create server with the number of worker threads for dispatching requests.
+	 *
+	 * Without workers all requests are dispatched by the thread calling Run().
+	 */
+	Server(unsigned int num_workers = 0);
+	~Server() noexcept(false);
+
+	/*
+	 * Put server socket in listening mode, incoming connections are accepted by Run().
+	 */
+	void Listen(int port = 5000);
+
+#ifdef __linux__
+	/*
+	 * Listen for clients on the same host connecting via Unix domain socket, see Client::ConnectUnix().
+	 */
+	void ListenUnix(std::string path);
+
+	/*
+	 * Listen for clients on the same host connecting via shared memory, see Client::ConnectShared().
+	 *
+	 * The port only names the (abstract) Unix domain socket and may be used in addition to Listen().
+	 */
+	void ListenShared(int port = 5000);
+#endif
+
+	/*
+	 * Accept connections of the listener in Run().
+	 */
+	void Listen(std::unique_ptr<Listener> listener);
+
+	/*
+	 * Create connection within the process, returning the client end for Client::Connect().
+	 *
+	 * Requests are dispatched by the workers started by Run(), or without workers by the
+	 * thread of the caller. The server has to outlive the client.
+	 */
+	std::unique_ptr<Channel> ConnectLoopback();
+
+	/*
+	 * Accept connections and handle incoming calls on any connection, starting and finally joining the workers.
+	 */
+	void Run();
+
+	/*
+	 * Stop accepting new connections and let Run() return.
+	 */
+	void Stop();
+
+	/*
+	 * Register cleanup handler for the current client being handled.
+	 *
+	 * Handlers run in reverse order of registration when the client disconnects.
+	 */
+	void PushCleanup(ID cleanup_id, CleanupHandler handler);
+	void RemoveCleanup(ID cleanup_id);
+
+	/*
+	 * Call the handler every interval from the thread running Run(), e.g. to poll devices the reactor can not watch.
+	 *
+	 * Handlers are called without holding a lock of the server. Removing a timer from another thread waits
+	 * for its handler to return, so the handler must not wait for the caller of RemoveTimer().
+	 */
+	void AddTimer(ID timer_id, std::chrono::milliseconds interval, TimerHandler handler);
+	void RemoveTimer(ID timer_id);
+
+	/*
+	 * Get the current client being handled, throws if called outside of a handler.
+	 */
+	ClientID GetCurrentClient();
+
+	/*
+	 * Post call to a method registered by the client, which is handled by the receiver thread of the client.
+	 *
+	 * May be called from any thread. Returns false if the client is not connected anymore.
+	 */
+	template <typename... Args>
+	bool Post(ClientID client, ID method_id, Args&&... args)
+	{
+		auto request = std::make_unique<sf::Packet>();
+
+		/*
+		 * Calls start with a zero request ID, which is never used for replies.
+		 */
+		*request << (sf::Uint32)0;
+		*request << method_id;
+		*request << (sf::Uint32)0;
+
+		(put_arg(*request, std::forward<Args>(args)), ...);
+
+		return post(client, std::move(request));
+	}
+
+	/*
+	 * Post typed call to a method registered by the client, see Post.
+	 */
+	template <typename R, typename... Args, typename... Params>
+	bool Post(ClientID client, Method<R(Args...)> method, Params&&... params)
+	{
+		auto request = std::make_unique<sf::Packet>();
+
+		*request << (sf::Uint32)0;
+		*request << method.GetID();
+		*request << (sf::Uint32)0;
+
+		Marshal<R(Args...)>::Encode(*request, std::forward<Params>(params)...);
+
+		return post(client, std::move(request));
+	}
+
+	/*
+	 * Post call with arguments encoded before, e.g. once for all members of a group.
+	 *
+	 * Only the header is built for the client, the encoded arguments are sent from the shared buffer.
+	 */
+	template <typename R, typename... Args>
+	bool Post(ClientID client, Method<R(Args...)> method, Message<R(Args...)> message)
+	{
+		auto request = std::make_unique<sf::Packet>();
+
+		*request << (sf::Uint32)0;
+		*request << method.GetID();
+		*request << (sf::Uint32)0;
+
+		return post(client, std::move(request), message.packet);
+	}
+
+	/*
+	 * Make a call to a method registered by the client and return the reply as a vector.
+	 *
+	 * Replies are received by Run(), so handlers may only wait for them if the server has workers.
+	 * If the client disconnects before replying, std::future_error (broken promise) is thrown.
+	 */
+	template <typename... Args>
+	std::vector<std::any> Call(ClientID client, ID method_id, Args&&... args)
+	{
+		return CallAsync(client, method_id, std::forward<Args>(args)...).get();
+	}
+
+	/*
+	 * Make a typed call to a method registered by the client and return the result, see Call.
+	 */
+	template <typename R, typename... Args, typename... Params>
+	R Call(ClientID client, Method<R(Args...)> method, Params&&... params)
+	{
+		return CallAsync(client, method, std::forward<Params>(params)...).get();
+	}
+
+	/*
+	 * Make a call to a method registered by the client without waiting, the future is ready when the reply arrived.
+	 */
+	template <typename... Args>
+	std::future<std::vector<std::any>> CallAsync(ClientID client, ID method_id, Args&&... args)
+	{
+		auto promise = std::make_shared<std::promise<std::vector<std::any>>>();
+		auto future = promise->get_future();
+
+		CallAsync([promise](std::vector<std::any> result) {
+				promise->set_value(result);
+			}, client, method_id, std::forward<Args>(args)...);
+
+		return future;
+	}
+
+	/*
+	 * Make a call to a method registered by the client without waiting.
+	 *
+	 * The completion is called by the thread receiving the reply (usually the one in Run()), it is dropped
+	 * without being called if the client disconnects before. Returns false if the client is not connected.
+	 */
+	template <typename... Args>
+	bool CallAsync(Completion completion, ClientID client, ID method_id, Args&&... args)
+	{
+		sf::Uint32 request_id = make_request_id();
+
+		auto request = std::make_unique<sf::Packet>();
+
+		*request << (sf::Uint32)0;
+		*request << method_id;
+		*request << request_id;
+
+		(put_arg(*request, std::forward<Args>(args)), ...);
+
+		return submit(client, request_id, std::move(request), ReplyHandler([completion](Reader& reply) {
+				std::vector<std::any> result;
+
+				get_values(reply, result);
+
+				completion(result);
+			}));
+	}
+
+	/*
+	 * Make a typed call to a method registered by the client without waiting, see CallAsync.
+	 */
+	template <typename R, typename... Args, typename... Params>
+	std::future<R> CallAsync(ClientID client, Method<R(Args...)> method, Params&&... params)
+	{
+		auto promise = std::make_shared<std::promise<R>>();
+		auto future = promise->get_future();
+
+		sf::Uint32 request_id = make_request_id();
+
+		auto request = std::make_unique<sf::Packet>();
+
+		*request << (sf::Uint32)0;
+		*request << method.GetID();
+		*request << request_id;
+
+		Marshal<R(Args...)>::Encode(*request, std::forward<Params>(params)...);
+
+		submit(client, request_id, std::move(request), ReplyHandler([promise](Reader& reply) {
+				try {
+					if constexpr (std::is_void_v<R>)
+						promise->set_value();
+					else
+						promise->set_value(Marshal<R(Args...)>::DecodeResult(reply));
+				}
+				catch (...) {
+					promise->set_exception(std::current_exception());
+				}
+			}));
+
+		return future;
+	}
+
+	/*
+	 * Limit number of connections, zero for no limit other than the open files limit.
+	 */
+	void SetMaxConnections(size_t max_connections);
+
+	/*
+	 * Get number of connections.
+	 */
+	size_t GetConnectionCount();
+
+	/*
+	 * Limit the bytes waiting to be sent to each client, zero for no limit (default).
+	 *
+	 * Applies to connected and new clients. Only posted calls are dropped, replies and calls
+	 * waiting for a reply are still queued, unless the policy is DISCONNECT.
+	 */
+	void SetQueueLimit(size_t max_bytes, OverflowPolicy policy);
+
+	/*
+	 * Limit the bytes waiting to be sent to one client, returns false if not connected anymore.
+	 */
+	bool SetQueueLimit(ClientID client, size_t max_bytes, OverflowPolicy policy);
+
+	/*
+	 * Get statistics of the queue of one client, returns false if not connected anymore.
+	 */
+	bool GetQueueStatistics(ClientID client, QueueStatistics& statistics);
+
+	/*
+	 * Get total of all queues, including drops and disconnects of closed connections.
+	 */
+	QueueStatistics GetQueueStatistics();
+
+private:
+	/*
+	 * Get listener registered with the context, NULL for connections.
+	 */
+	Listener* find_listener(void* context);
+
+	/*
+	 * Accept all pending connections.
+	 */
+	void accept(Listener* listener);
+
+	/*
+	 * Add connection to the connection table.
+	 */
+	void add(Connection* connection);
+
+	/*
+	 * Send queued replies and receive all pending requests of the connection, the lock has to be held.
+	 */
+	void receive(Connection* connection, int events, std::unique_lock<std::mutex>& l);
+
+	/*
+	 * Handle request directly or queue it for the workers, the lock has to be held.
+	 *
+	 * Without workers the lock is released while handling. Returns false if the connection
+	 * was closed meanwhile and has been deleted.
+	 */
+	bool process(Connection* connection, std::unique_ptr<sf::Packet> request, std::unique_lock<std::mutex>& l);
+
+	/*
+	 * Check the first request of a connection, which has to carry the version of the wire format, and reply with ours.
+	 *
+	 * Connections of clients with another version are shut down.
+	 */
+	void check_version(Connection* connection, sf::Packet& request);
+
+	/*
+	 * Send packet followed by the (shared) body or queue them until the channel becomes writable.
+	 *
+	 * Posted packets may be dropped if the queue is full, see SetQueueLimit().
+	 */
+	void send(Connection* connection, std::unique_ptr<sf::Packet> packet, std::shared_ptr<const sf::Packet> body = nullptr, bool posted = false);
+
+	/*
+	 * Make room for a packet of the size in a full queue, returns false if it has to be dropped.
+	 *
+	 * The send lock has to be held.
+	 */
+	bool overflow(Connection* connection, size_t size, bool posted);
+
+	/*
+	 * Send call to the client if still connected.
+	 */
+	bool post(ClientID client, std::unique_ptr<sf::Packet> request, std::shared_ptr<const sf::Packet> body = nullptr);
+
+	/*
+	 * Find connection of the client, connections_lock has to be held.
+	 */
+	Connection* find_connection(ClientID client);
+
+	/*
+	 * Generate a new request ID for calls to clients, never being zero (used for posted calls).
+	 */
+	sf::Uint32 make_request_id();
+
+	/*
+	 * Add handler to pending calls of the client and send the request, unless the client is not connected.
+	 */
+	bool submit(ClientID client, sf::Uint32 request_id, std::unique_ptr<sf::Packet> request, ReplyHandler handler);
+
+	/*
+	 * Run the handler of the call matching the reply of the client.
+	 */
+	void handle_reply(Connection* connection, std::shared_ptr<sf::Packet> reply);
+
+	/*
+	 * Send queued packets while the channel is writable.
+	 */
+	void flush(Connection* connection);
+
+	/*
+	 * Remove disconnected client, cleaning up unless busy.
+	 */
+	void close(Connection* connection);
+
+	/*
+	 * Shut the channel down and let Run() close the connection.
+	 *
+	 * Not every channel is reported by the reactor after a shutdown (e.g. loopback), so the
+	 * connection is not left to the reactor. May be called with any lock held.
+	 */
+	void disconnect(Connection* connection);
+
+	/*
+	 * Close the connections shut down by disconnect(), lock has to be held.
+	 */
+	void close_disconnected();
+
+	/*
+	 * Call the handlers of due timers, returning the time until the next one is due (negative for none).
+	 */
+	int run_timers();
+
+	/*
+	 * Pause or resume accepting connections.
+	 */
+	void set_accepting(bool enable);
+
+	/*
+	 * Run cleanup handlers for the specified connection.
+	 */
+	void cleanup(Connection* connection);
+
+	/*
+	 * Queue connection with received requests for the workers unless already queued.
+	 */
+	void schedule(Connection* connection);
+
+	/*
+	 * Worker thread handling requests of queued connections.
+	 */
+	void work();
+
+	/*
+	 * Dispatch request as the current client and send the reply.
+	 *
+	 * Errors of the handler are caught, the client gets a reply without values.
+	 */
+	void handle(Connection* connection, sf::Packet& request);
+
+	/*
+	 * Make reply without values to a failed request, returns false for posted calls.
+	 */
+	bool error_reply(const sf::Packet& request, sf::Packet& reply);
+
+private:
+	/*
+	 * Handle request (incoming call) and fill packet for reply.
+	 *
+	 * Returns false if no reply is to be sent (posted call).
+	 */
+	bool dispatch(sf::Packet& request, sf::Packet& reply);
+};
+
+
+/*
+ * Client class for using the service via TCP or other transports (see Channel).
+ *
+ * Each request carries a request ID that is echoed by the server in its reply.
+ * Replies are received by a separate thread and matched against the pending
+ * requests, allowing many calls to be in flight on one connection.
+ */
+class Client : public Host
+{
+public:
+	/*
+	 * Completion handler for asynchronous calls, being called from the receiver thread.
+	 */
+	typedef std::function<void(std::vector<std::any>)> Completion;
+
+private:
+	/*
+	 * Handler for the reply packet, read position being behind the request ID.
+	 */
+	typedef std::function<void(Reader& reply)> ReplyHandler;
+
+	std::mutex lock;
+	std::mutex send_lock;
+	std::unique_ptr<Channel> channel;
+	std::thread *receiver;
+	bool running;
+	sf::Uint32 request_ids;
+	std::map<sf::Uint32, ReplyHandler> pending;
+
+public:
 	Client();
+	~Client();
 
 	/*
 	 * Connect to server specified by host and port number.
 	 */
 	void Connect(std::string host = "127.0.0.1", int port = 5000);
-	
+
+#ifdef __linux__
+	/*
+	 * Connect to server on the same host via Unix domain socket, see Server::ListenUnix().
+	 */
+	void ConnectUnix(std::string path);
+
+	/*
+	 * Connect to server on the same host via shared memory, see Server::ListenShared().
+	 */
+	void ConnectShared(int port = 5000);
+#endif
+
+	/*
+	 * Connect via the channel, e.g. Server::ConnectLoopback() for a server in the same process.
+	 */
+	void Connect(std::unique_ptr<Channel> channel);
+
 	/*
 	 * Make a call to the server and return the reply as a vector.
 	 */
 	template <typename... Args>
 	std::vector<std::any> Call(ID method_id, Args&&... args)
+	{
+		return CallAsync(method_id, std::forward<Args>(args)...).get();
+	}
+
+	/*
+	 * Make a typed call to the server and return the result.
+	 *
+	 * Arguments are converted to the types of the signature, mismatching types fail to compile.
+	 */
+	template <typename R, typename... Args, typename... Params>
+	R Call(Method<R(Args...)> method, Params&&... params)
+	{
+		return CallAsync(method, std::forward<Params>(params)...).get();
+	}
+
+	/*
+	 * Make a call to the server (with data buffer) and return the reply as a vector.
+	 */
+	template <typename... Args>
+	std::vector<std::any> Call2(ID method_id, const void* ptr, size_t length, Args&&... args)
+	{
+		return Call2Async(method_id, { Data(ptr, length) }, std::forward<Args>(args)...).get();
+	}
+
+	/*
+	 * Make a call to the server (with data buffers) and return the reply as a vector.
+	 */
+	template <typename... Args>
+	std::vector<std::any> Call2(ID method_id, const std::vector<Data>& blobs, Args&&... args)
+	{
+		return Call2Async(method_id, blobs, std::forward<Args>(args)...).get();
+	}
+
+	/*
+	 * Post a call to the server without requesting a reply (one-way call).
+	 *
+	 * The server still handles the call in order with other calls on this connection.
+	 */
+	template <typename... Args>
+	void Post(ID method_id, Args&&... args)
 	{
 		sf::Packet request;
 
 		request << method_id;
+		request << (sf::Uint32)0;
 
 		/*
 		 * Append all arguments to the request packet.
 		 */
 		(put_arg(request, std::forward<Args>(args)), ...);
 
-		socket.send(request);
-
+		send(request);
+	}
 
-		/*
-		 * Receive and parse the reply packet.
-		 */
-		sf::Packet reply;
+	/*
+	 * Post a typed call to the server without requesting a reply (one-way call).
+	 */
+	template <typename R, typename... Args, typename... Params>
+	void Post(Method<R(Args...)> method, Params&&... params)
+	{
+		sf::Packet request;
 
-		socket.receive(reply);
+		request << method.GetID();
+		request << (sf::Uint32)0;
 
-		std::vector<std::any> result;
+		Marshal<R(Args...)>::Encode(request, std::forward<Params>(params)...);
 
-		get_values(reply, result);
+		send(request);
+	}
 
-		return result;
+	/*
+	 * Post a call to the server (with data buffer) without requesting a reply (one-way call).
+	 */
+	template <typename... Args>
+	void Post2(ID method_id, const void* ptr, size_t length, Args&&... args)
+	{
+		Post2(method_id, { Data(ptr, length) }, std::forward<Args>(args)...);
 	}
 
 	/*
-	 * Make a call to the server (with data buffer) and return the reply as a vector.
+	 * Post a call to the server (with data buffers) without requesting a reply (one-way call).
+	 *
+	 * The data buffers are appended as DATA values behind the arguments.
 	 */
 	template <typename... Args>
-	std::vector<std::any> Call2(ID method_id, const void* ptr, size_t length, Args&&... args)
+	void Post2(ID method_id, const std::vector<Data>& blobs, Args&&... args)
 	{
 		sf::Packet request;
 
 		request << method_id;
+		request << (sf::Uint32)0;
 
 		/*
 		 * Append all arguments to the request packet.
@@ -347,28 +2235,183 @@ public:
 		(put_arg(request, std::forward<Args>(args)), ...);
 
 		/*
-		 * Append data buffer to the request packet.
+		 * Data buffers are sent from caller memory behind the request packet.
 		 */
-		request << Packet::DATA;
-		request.append(ptr, length);
+		send(request, blobs);
+	}
+
+	/*
+	 * Make a call to the server without waiting, the future is ready when the reply arrived.
+	 *
+	 * If the connection is lost before, the future throws std::future_error (broken promise).
+	 */
+	template <typename... Args>
+	std::future<std::vector<std::any>> CallAsync(ID method_id, Args&&... args)
+	{
+		auto promise = std::make_shared<std::promise<std::vector<std::any>>>();
+		auto future = promise->get_future();
+
+		CallAsync([promise](std::vector<std::any> result) {
+				promise->set_value(result);
+			}, method_id, std::forward<Args>(args)...);
+
+		return future;
+	}
+
+	/*
+	 * Make a call to the server without waiting, the completion is called when the reply arrived.
+	 */
+	template <typename... Args>
+	void CallAsync(Completion completion, ID method_id, Args&&... args)
+	{
+		sf::Uint32 request_id = make_request_id();
 
-		socket.send(request);
+		sf::Packet request;
 
+		request << method_id;
+		request << request_id;
 
 		/*
-		 * Receive and parse the reply packet.
+		 * Append all arguments to the request packet.
 		 */
-		sf::Packet reply;
+		(put_arg(request, std::forward<Args>(args)), ...);
+
+		submit(request_id, request, completion);
+	}
+
+	/*
+	 * Make a typed call to the server without waiting, see CallAsync.
+	 *
+	 * The future throws std::runtime_error if the reply does not match the signature.
+	 */
+	template <typename R, typename... Args, typename... Params>
+	std::future<R> CallAsync(Method<R(Args...)> method, Params&&... params)
+	{
+		auto promise = std::make_shared<std::promise<R>>();
+		auto future = promise->get_future();
+
+		sf::Uint32 request_id = make_request_id();
+
+		sf::Packet request;
+
+		request << method.GetID();
+		request << request_id;
+
+		Marshal<R(Args...)>::Encode(request, std::forward<Params>(params)...);
+
+		submit(request_id, request, ReplyHandler([promise](Reader& reply) {
+				try {
+					if constexpr (std::is_void_v<R>)
+						promise->set_value();
+					else
+						promise->set_value(Marshal<R(Args...)>::DecodeResult(reply));
+				}
+				catch (...) {
+					promise->set_exception(std::current_exception());
+				}
+			}));
+
+		return future;
+	}
+
+	/*
+	 * Make a call to the server (with data buffer) without waiting, see CallAsync.
+	 */
+	template <typename... Args>
+	std::future<std::vector<std::any>> Call2Async(ID method_id, const void* ptr, size_t length, Args&&... args)
+	{
+		return Call2Async(method_id, { Data(ptr, length) }, std::forward<Args>(args)...);
+	}
+
+	/*
+	 * Make a call to the server (with data buffers) without waiting, see CallAsync.
+	 */
+	template <typename... Args>
+	std::future<std::vector<std::any>> Call2Async(ID method_id, const std::vector<Data>& blobs, Args&&... args)
+	{
+		auto promise = std::make_shared<std::promise<std::vector<std::any>>>();
+		auto future = promise->get_future();
+
+		Call2Async([promise](std::vector<std::any> result) {
+				promise->set_value(result);
+			}, method_id, blobs, std::forward<Args>(args)...);
+
+		return future;
+	}
+
+	/*
+	 * Make a call to the server (with data buffer) without waiting, see CallAsync.
+	 */
+	template <typename... Args>
+	void Call2Async(Completion completion, ID method_id, const void* ptr, size_t length, Args&&... args)
+	{
+		Call2Async(completion, method_id, { Data(ptr, length) }, std::forward<Args>(args)...);
+	}
+
+	/*
+	 * Make a call to the server (with data buffers) without waiting, see CallAsync.
+	 */
+	template <typename... Args>
+	void Call2Async(Completion completion, ID method_id, const std::vector<Data>& blobs, Args&&... args)
+	{
+		sf::Uint32 request_id = make_request_id();
 
-		socket.receive(reply);
+		sf::Packet request;
 
-		std::vector<std::any> result;
+		request << method_id;
+		request << request_id;
 
-		get_values(reply, result);
+		/*
+		 * Append all arguments to the request packet.
+		 */
+		(put_arg(request, std::forward<Args>(args)), ...);
 
-		return result;
+		/*
+		 * Data buffers are sent from caller memory behind the request packet.
+		 */
+		submit(request_id, request, completion, blobs);
 	}
 
+private:
+	/*
+	 * Generate a new request ID, never being zero (used for posted calls).
+	 */
+	sf::Uint32 make_request_id();
+
+	/*
+	 * Add completion to pending requests and send the request packet (followed by data buffers).
+	 */
+	void submit(sf::Uint32 request_id, sf::Packet& request, Completion completion, const std::vector<Data>& blobs = {});
+	void submit(sf::Uint32 request_id, sf::Packet& request, ReplyHandler handler, const std::vector<Data>& blobs = {});
+
+	/*
+	 * Send the request packet followed by the data buffers as DATA values in a single message.
+	 */
+	void send(sf::Packet& request, const std::vector<Data>& blobs = {});
+
+	/*
+	 * Receive replies and run completions of matching requests until disconnected.
+	 */
+	void receive_replies();
+
+	/*
+	 * Send the version of the wire format to the server, which disconnects on mismatch.
+	 *
+	 * The reply is not awaited, calls made meanwhile fail with a broken promise on mismatch.
+	 */
+	void check_version();
+
+	/*
+	 * Parse reply and run completion of matching request.
+	 */
+	void handle_reply(std::shared_ptr<sf::Packet> packet);
+
+	/*
+	 * Handle call from the server, read position being behind the zero request ID.
+	 *
+	 * Replies are sent with a zero method ID, which never identifies a method.
+	 */
+	void handle_call(std::shared_ptr<sf::Packet> packet);
 };
 
 
@@ -390,6 +2433,24 @@ protected:
 	InterfaceClient(Client& client, ID method_id);
 	~InterfaceClient();
 
+	/*
+	 * Make a typed call of a method of the interface API, e.g. Call<sf::Int64()>(GET_TIME).
+	 */
+	template <typename Signature, typename... Params>
+	auto Call(int method, Params&&... params)
+	{
+		return client.Call(typename Marshal<Signature>::InterfaceMethod(method_id), method, std::forward<Params>(params)...);
+	}
+
+	/*
+	 * Post a typed call of a method of the interface API, see Call.
+	 */
+	template <typename Signature, typename... Params>
+	void Post(int method, Params&&... params)
+	{
+		client.Post(typename Marshal<Signature>::InterfaceMethod(method_id), method, std::forward<Params>(params)...);
+	}
+
 public:
 	ID GetMethodID() const;
 };
@@ -401,35 +2462,25 @@ public:
 template <typename IFace>
 class InterfaceServer
 {
+private:
+	/*
+	 * Handler of a method of the interface API being bound at construction, see Bind.
+	 */
+	typedef void (*MethodInvoker)(InterfaceServer* self, typename IFace::Method method, Reader& request, sf::Packet* reply);
+
 protected:
 	Server& server;
 	ID method_id;
+	std::bitset<IFace::_NUM_METHODS> oneway;
+	std::array<MethodInvoker, IFace::_NUM_METHODS> invokers = {};
+	std::array<std::shared_ptr<void>, IFace::_NUM_METHODS> handlers;	// bound via Bind<Signature>, owned only
 
 protected:
 	InterfaceServer(Server& server)
 		:
 		server(server)
 	{
-		method_id = server.Register([&server, this](std::vector<std::any> args) -> std::any
-			{
-				typename IFace::Method method = (typename IFace::Method)(std::any_cast<int>(args[0]));
-
-				/*
-				 * Common handler for releasing the interface.
-				 */
-				if (method == IFace::RELEASE) {
-					server.RemoveCleanup(method_id);
-					delete this;
-					return 0;
-				}
-
-				/*
-				 * Specific handlers for interface API.
-				 */
-				std::function<std::any(std::vector<std::any>)> handler = Lookup(method);
-
-				return handler(args);
-			});
+		method_id = server.RegisterInvoker(&InterfaceServer::dispatch, this);
 
 		server.RegisterInterface(method_id, this);
 
@@ -438,16 +2489,156 @@ protected:
 			});
 	}
 
-	~InterfaceServer()
+	/*
+	 * Interfaces delete themselves on release or cleanup, so the destructor of the implementation has to run.
+	 */
+	virtual ~InterfaceServer()
 	{
 		server.UnregisterInterface(method_id);
 		server.Unregister(method_id);
 	}
 
 	/*
-	 * This method has to be implemented by each server side interface class for handling incoming calls.
+	 * Mark method of interface API as one-way, its result is discarded and no reply values are sent.
+	 */
+	void SetOneWay(typename IFace::Method method)
+	{
+		oneway.set(method);
+	}
+
+	/*
+	 * Bind a member function to a method of the interface API, e.g. Bind<&Clock_Server::get_time>(GET_TIME).
+	 *
+	 * The signature is taken from the member function, calls go through a plain function pointer
+	 * without any copy or type erasure. Member functions taking a std::vector<std::any> get the
+	 * values of the call (method first) like handlers returned by Lookup.
+	 */
+	template <auto Member>
+	void Bind(typename IFace::Method method)
+	{
+		invokers[method] = &InterfaceServer::invoke_member<Member>;
+	}
+
+	/*
+	 * Bind a typed handler to a method of the interface API, e.g. Bind<sf::Int64()>(GET_TIME, handler).
+	 *
+	 * The handler is kept as is and called through a plain function pointer like bound member functions.
+	 *
+	 * Methods not being bound are looked up via Lookup() and get their arguments as a vector. That path
+	 * still copies a std::function and goes through a virtual call and std::any for each call.
+	 */
+	template <typename Signature, typename Handler>
+	void Bind(typename IFace::Method method, Handler handler)
+	{
+		handlers[method] = std::make_shared<Handler>(std::move(handler));
+		invokers[method] = &InterfaceServer::invoke_handler<Signature, Handler>;
+	}
+
+	/*
+	 * Handle a call of a method of the interface API, the request being read behind the method.
+	 *
+	 * The reply is NULL if no result is wanted.
+	 */
+	void Invoke(typename IFace::Method method, Reader& request, sf::Packet* reply)
+	{
+		if (method < 0 || method >= IFace::_NUM_METHODS)
+			throw std::runtime_error("invalid interface method");
+
+		if (oneway[method])
+			reply = NULL;
+
+		if (invokers[method]) {
+			invokers[method](this, method, request, reply);
+			return;
+		}
+
+		/*
+		 * Specific handlers for interface API.
+		 */
+		std::function<std::any(std::vector<std::any>)> handler = Lookup(method);
+
+		if (!handler)
+			throw std::runtime_error("unhandled interface method");
+
+		std::vector<std::any> args;
+
+		args.push_back((int)method);
+
+		Host::get_values(request, args);
+
+		std::any result = handler(args);
+
+		if (reply && result.has_value())
+			Host::any_to_packet(result, *reply);
+	}
+
+	/*
+	 * This method may be implemented by server side interface classes for handling methods not being bound.
+	 */
+	virtual std::function<std::any(std::vector<std::any>)> Lookup(typename IFace::Method) const
+	{
+		return nullptr;
+	}
+
+private:
+	/*
+	 * Entry point of all calls to the interface.
 	 */
-	virtual std::function<std::any(std::vector<std::any>)> Lookup(typename IFace::Method method) const = 0;
+	static void dispatch(void* context, Reader& request, sf::Packet* reply)
+	{
+		InterfaceServer* self = (InterfaceServer*)context;
+
+		int method = -1;
+
+		Host::get_arg(request, method);
+
+		/*
+		 * Common handler for releasing the interface.
+		 */
+		if (method == IFace::RELEASE) {
+			self->server.RemoveCleanup(self->method_id);
+			delete self;
+			return;
+		}
+
+		self->Invoke((typename IFace::Method)method, request, reply);
+	}
+
+	template <typename Signature, typename Handler>
+	static void invoke_handler(InterfaceServer* self, typename IFace::Method method, Reader& request, sf::Packet* reply)
+	{
+		Marshal<Signature>::Invoke(*static_cast<const Handler*>(self->handlers[method].get()), request, reply);
+	}
+
+	template <auto Member>
+	static void invoke_member(InterfaceServer* self, typename IFace::Method method, Reader& request, sf::Packet* reply)
+	{
+		typedef MemberFunction<decltype(Member)> Function;
+
+		auto object = static_cast<typename Function::Class*>(self);
+
+		if constexpr (Function::dynamic) {
+			std::vector<std::any> args;
+
+			args.push_back((int)method);
+
+			Host::get_values(request, args);
+
+			if constexpr (std::is_void_v<typename Function::Result>)
+				(object->*Member)(args);
+			else {
+				std::any result = (object->*Member)(args);
+
+				if (reply && result.has_value())
+					Host::any_to_packet(result, *reply);
+			}
+		}
+		else {
+			Marshal<typename Function::Signature>::Invoke([object](auto&&... args) {
+					return (object->*Member)(std::forward<decltype(args)>(args)...);
+				}, request, reply);
+		}
+	}
 
 public:
 	ID GetMethodID() const
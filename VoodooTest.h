@@ -16,6 +16,7 @@ class Setup
 public:
 	bool test_server;
 	bool test_client;
+	bool shared;	// local client connects via shared memory
 
 	unsigned int mode;
 	std::string host;
@@ -25,15 +26,22 @@ public:
 		:
 		test_server(false),
 		test_client(false),
+		shared(false),
 		mode(0),
 		host("127.0.0.1")
 	{
 		/* Select Server/Client Mode */
 
 		std::cout << "Please select running" << std::endl;
+#ifdef __linux__
+		std::cout << " 1         both client & server (shared memory)" << std::endl;
+		std::cout << " 2         server only (0.0.0.0:5000 and shared memory)" << std::endl;
+		std::cout << " 3         local client (shared memory)" << std::endl;
+#else
 		std::cout << " 1         both client & server (127.0.0.1:5000)" << std::endl;
 		std::cout << " 2         server only (0.0.0.0:5000)" << std::endl;
 		std::cout << " 3         local client (127.0.0.1:5000)" << std::endl;
+#endif
 		std::cout << " 4 <host>  remote client (host:5000)" << std::endl;
 		std::cout << std::endl;
 
@@ -44,12 +52,14 @@ public:
 		case 1:
 			test_server = true;
 			test_client = true;
+			shared = true;
 			break;
 		case 2:
 			test_server = true;
 			break;
 		case 3:
 			test_client = true;
+			shared = true;
 			break;
 		case 4:
 			test_client = true;
@@ -62,14 +72,32 @@ public:
 
 		/* Initialize Server(Listen) and Client(Connect) */
 
-		if (test_server)
+#ifndef __linux__
+		shared = false;
+#endif
+
+		if (test_server) {
 			server.Listen();
+#ifdef __linux__
+			server.ListenShared();
+#endif
+		}
 
 		if (test_client) {
 			try {
-				std::cout << "Connecting to " << host << "...";
-
-				client.Connect(host);
+#ifdef __linux__
+				if (shared) {
+					std::cout << "Connecting via shared memory...";
+
+					client.ConnectShared();
+				}
+				else
+#endif
+				{
+					std::cout << "Connecting to " << host << "...";
+
+					client.Connect(host);
+				}
 			}
 			catch (...) {
 				std::cout << " FAILED!" << std::endl;
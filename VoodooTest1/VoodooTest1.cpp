@@ -1,4 +1,3 @@
-#include <array>
 #include <iostream>
 
 #ifdef _WIN32
@@ -57,14 +56,12 @@ public:
 
 	Time GetTime()
 	{
-		auto result = client.Call(method_id, (int)GET_TIME);
-
-		return Time(std::any_cast<sf::Int64>(result[0]));
+		return Time(Call<sf::Int64()>(GET_TIME));
 	}
 
 	void SetTime(const Time& time)
 	{
-		client.Call(method_id, (int)SET_TIME, time.GetHours(), time.GetMinutes(), time.GetSeconds());
+		Call<void(unsigned int, unsigned int, unsigned int)>(SET_TIME, time.GetHours(), time.GetMinutes(), time.GetSeconds());
 	}
 };
 
@@ -74,41 +71,32 @@ class IClock_Server : public Voodoo::InterfaceServer<IClock>
 private:
 	sf::Int64 time_offset;
 
-	std::array<std::function<std::any(std::vector<std::any>)>, IClock::_NUM_METHODS> dispatch;
-
 public:
 	IClock_Server(Voodoo::Server& server)
 		:
 		InterfaceServer(server),
 		time_offset(0)
 	{
-		dispatch[IClock::GET_TIME] = [this](std::vector<std::any> args) -> std::any
-		{
-			sf::Int64 current = get_current_time();
-
-			return current + time_offset;
-		};
-
-		dispatch[IClock::SET_TIME] = [this](std::vector<std::any> args) -> std::any
-		{
-			sf::Int64 current = get_current_time();
+		Bind<&IClock_Server::get_time>(IClock::GET_TIME);
+		Bind<&IClock_Server::set_time>(IClock::SET_TIME);
+	}
 
-			time_offset =
-				std::any_cast<unsigned int>(args[1]) * 60LL * 60LL +
-				std::any_cast<unsigned int>(args[2]) * 60LL +
-				std::any_cast<unsigned int>(args[3]);
-			time_offset -= current;
+private:
+	sf::Int64 get_time()
+	{
+		sf::Int64 current = get_current_time();
 
-			return 0;
-		};
+		return current + time_offset;
 	}
 
-	virtual std::function<std::any(std::vector<std::any>)> Lookup(IClock::Method method) const
+	void set_time(unsigned int hours, unsigned int minutes, unsigned int seconds)
 	{
-		return dispatch[method];
+		sf::Int64 current = get_current_time();
+
+		time_offset = hours * 60LL * 60LL + minutes * 60LL + seconds;
+		time_offset -= current;
 	}
 
-private:
 	sf::Int64 get_current_time() const
 	{
 #ifdef _WIN32
@@ -141,12 +129,12 @@ int main()
 	VoodooTest::Setup setup(server, client);
 
 
-	Voodoo::ID clock_id = 1;	// In this case we know the ID that is used on the server to register
+	Voodoo::Method<Voodoo::ID()> create_clock(1);	// In this case we know the ID that is used on the server to register
 
 	std::unique_ptr<std::thread> server_loop;
 
 	if (setup.test_server) {
-		clock_id = server.Register([&server](std::vector<std::any> args)
+		create_clock = server.Register<Voodoo::ID()>([&server]()
 			{
 				auto clock = new IClock_Server(server);
 
@@ -161,9 +149,7 @@ int main()
 
 
 	if (setup.test_client) {
-		auto result = client.Call(clock_id);
-
-		auto clock = new IClock(client, std::any_cast<Voodoo::ID>(result[0]));
+		auto clock = new IClock(client, client.Call(create_clock));
 
 		IClock::Time time = clock->GetTime();
 
@@ -0,0 +1,463 @@
+#include <array>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <random>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include "Voodoo.h"
+
+
+/*
+ * Micro benchmarks of server side dispatch, no network involved
+ */
+class Benchmark
+{
+private:
+	std::string name;
+	std::chrono::steady_clock::time_point start;
+
+public:
+	Benchmark(std::string name)
+		:
+		name(name),
+		start(std::chrono::steady_clock::now())
+	{
+	}
+
+	void Report(size_t iterations)
+	{
+		auto end = std::chrono::steady_clock::now();
+
+		double ns = std::chrono::duration<double, std::nano>(end - start).count();
+
+		std::cout << "  " << name << ": " << ns / iterations << " ns/op" << std::endl;
+	}
+};
+
+
+/*
+ * Lookup of interfaces by ID, as done for each resource passed to a method (e.g. draw_sprite)
+ */
+static void bench_registry(size_t num_interfaces, size_t iterations)
+{
+	std::cout << "Registry with " << num_interfaces << " interfaces" << std::endl;
+
+	Voodoo::Server server;
+
+	std::vector<Voodoo::ID> ids;
+	std::map<Voodoo::ID, void*> tree;	// previous registry layout for comparison
+
+	for (size_t i = 0; i < num_interfaces; i++) {
+		Voodoo::ID id = server.Register([](std::vector<std::any>) -> std::any
+			{
+				return std::any();
+			});
+
+		server.RegisterInterface(id, &ids);
+
+		tree[id] = &ids;
+
+		ids.push_back(id);
+	}
+
+	/*
+	 * Random order, as resources used per frame are spread over the registry.
+	 */
+	std::vector<Voodoo::ID> order;
+	std::mt19937 random(1);
+
+	for (size_t i = 0; i < iterations; i++)
+		order.push_back(ids[random() % ids.size()]);
+
+	size_t found = 0;
+
+	Benchmark map_lookup("std::map lookup");
+
+	for (auto id : order)
+		found += tree.find(id)->second != NULL;
+
+	map_lookup.Report(iterations);
+
+
+	Benchmark slot_lookup("Host::LookupInterface");
+
+	for (auto id : order)
+		found += server.LookupInterface(id) != NULL;
+
+	slot_lookup.Report(iterations);
+
+
+	Benchmark handle("Host::Handle");
+
+	for (auto id : order)
+		server.Handle(id, std::vector<std::any>());
+
+	handle.Report(iterations);
+
+
+	/*
+	 * Stale IDs are rejected after unregistering.
+	 */
+	server.UnregisterInterface(ids[0]);
+	server.Unregister(ids[0]);
+
+	Voodoo::ID reused = server.MakeID();
+
+	try {
+		server.LookupInterface(ids[0]);
+
+		std::cout << "  stale ID not detected!" << std::endl;
+	}
+	catch (std::runtime_error& e) {
+		std::cout << "  stale ID rejected (" << e.what() << "), slot reused as " << *reused << std::endl;
+	}
+
+	if (found != 2 * iterations)
+		std::cout << "  lookup failed!" << std::endl;
+}
+
+
+/*
+ * Interface with the same method being dispatched in different ways
+ */
+class IBench
+{
+public:
+	using Method = enum {
+		RELEASE,
+
+		ADD_LOOKUP,	// std::function returned by Lookup(), values as std::vector<std::any>
+		ADD_TYPED,	// typed callable bound with Bind<Signature>()
+		ADD_MEMBER,	// member function bound with Bind<&Member>()
+
+		_NUM_METHODS
+	};
+};
+
+class IBench_Server : public Voodoo::InterfaceServer<IBench>
+{
+private:
+	std::array<std::function<std::any(std::vector<std::any>)>, IBench::_NUM_METHODS> dispatch;
+
+public:
+	IBench_Server(Voodoo::Server& server)
+		:
+		InterfaceServer(server)
+	{
+		dispatch[IBench::ADD_LOOKUP] = [this](std::vector<std::any> args) -> std::any
+		{
+			return add(std::any_cast<int>(args[1]), std::any_cast<int>(args[2]));
+		};
+
+		Bind<int(int, int)>(IBench::ADD_TYPED, [this](int a, int b)
+		{
+			return add(a, b);
+		});
+
+		Bind<&IBench_Server::add>(IBench::ADD_MEMBER);
+	}
+
+	virtual std::function<std::any(std::vector<std::any>)> Lookup(IBench::Method method) const
+	{
+		return dispatch[method];
+	}
+
+private:
+	int add(int a, int b)
+	{
+		return a + b;
+	}
+};
+
+/*
+ * Calls of an interface method, from decoding the request to encoding the reply
+ *
+ * The interface is created through a connected client, then the server is stopped so the
+ * calls below are the only ones handled while they run. The connection and with it the
+ * interface stay alive until the server is destroyed.
+ */
+static void bench_interface(size_t iterations)
+{
+	std::cout << "Interface dispatch" << std::endl;
+
+	Voodoo::Server server;
+	Voodoo::Client client;
+
+	/*
+	 * Interfaces are created on behalf of a client connection.
+	 */
+	IBench_Server* bench = NULL;
+
+	auto create_bench = server.Register<Voodoo::ID()>([&server, &bench]()
+		{
+			bench = new IBench_Server(server);
+
+			return bench->GetMethodID();
+		});
+
+	server.Listen(5001);
+
+	std::thread server_loop([&server]()
+		{
+			server.Run();
+		});
+
+	client.Connect("127.0.0.1", 5001);
+	client.Call(create_bench);
+
+	server.Stop();
+	server_loop.join();
+
+	const char* names[] = { NULL, "Lookup", "Bind<Signature>", "Bind<&Member>" };
+
+	for (int method = IBench::ADD_LOOKUP; method < IBench::_NUM_METHODS; method++) {
+		sf::Packet request;
+
+		for (int value : { method, 1, 2 }) {
+			request << (sf::Uint8)Voodoo::Packet::INT32;
+
+			Voodoo::put_zigzag(request, value);
+		}
+
+		sf::Packet reply;
+
+		Benchmark dispatch(names[method]);
+
+		for (size_t i = 0; i < iterations; i++) {
+			Voodoo::Reader reader(request);
+
+			reply.clear();
+
+			server.Handle(bench->GetMethodID(), reader, &reply);
+		}
+
+		dispatch.Report(iterations);
+	}
+}
+
+
+/*
+ * Round trips of calls between client and server on the same host
+ */
+static void bench_transport(size_t iterations, size_t data_size, size_t data_iterations)
+{
+	std::cout << "Transport round trips" << std::endl;
+
+	Voodoo::Server server;
+
+	auto add = server.Register<int(int, int)>([](int a, int b)
+		{
+			return a + b;
+		});
+
+	auto size = server.Register<size_t(Voodoo::Data)>([](Voodoo::Data data)
+		{
+			return data.size();
+		});
+
+	server.Listen(5002);
+#ifdef __linux__
+	server.ListenUnix("/tmp/voodoo-bench.sock");
+	server.ListenShared(5002);
+#endif
+
+	std::thread server_loop([&server]()
+		{
+			server.Run();
+		});
+
+	std::vector<sf::Uint8> data(data_size);
+
+	static const char* transports[] = { "TCP", "Unix socket", "shared memory", "loopback" };
+
+	for (std::string transport : transports) {
+		Voodoo::Client client;
+
+		if (transport == "TCP")
+			client.Connect("127.0.0.1", 5002);
+#ifdef __linux__
+		else if (transport == "Unix socket")
+			client.ConnectUnix("/tmp/voodoo-bench.sock");
+		else if (transport == "shared memory")
+			client.ConnectShared(5002);
+#endif
+		else if (transport == "loopback")
+			client.Connect(server.ConnectLoopback());
+		else
+			continue;
+
+		Benchmark call(transport + " call");
+
+		for (size_t i = 0; i < iterations; i++)
+			client.Call(add, (int)i, 1);
+
+		call.Report(iterations);
+
+
+		Benchmark data_call(transport + " call with " + std::to_string(data_size >> 10) + " KiB data");
+
+		for (size_t i = 0; i < data_iterations; i++)
+			client.Call(size, Voodoo::Data(data.data(), data.size()));
+
+		data_call.Report(data_iterations);
+	}
+
+	server.Stop();
+	server_loop.join();
+}
+
+
+#ifdef __linux__
+
+/*
+ * Resident memory of the process in bytes
+ */
+static size_t resident_size()
+{
+	size_t pages = 0;
+	size_t resident = 0;
+
+	std::ifstream("/proc/self/statm") >> pages >> resident;
+
+	return resident * sysconf(_SC_PAGESIZE);
+}
+
+/*
+ * Open idle TCP connections to the server, plain sockets keep the cost on this side small.
+ */
+static std::vector<int> connect_idle(int port, size_t count)
+{
+	std::vector<int> sockets;
+
+	sockaddr_in address = {};
+
+	address.sin_family = AF_INET;
+	address.sin_port = htons(port);
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	for (size_t i = 0; i < count; i++) {
+		int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+		if (fd < 0)
+			break;
+
+		if (connect(fd, (sockaddr*)&address, sizeof(address))) {
+			close(fd);
+			break;
+		}
+
+		sockets.push_back(fd);
+	}
+
+	return sockets;
+}
+
+/*
+ * Wait until the server has the number of connections, returns false on timeout.
+ */
+static bool wait_connections(Voodoo::Server& server, size_t count)
+{
+	for (int i = 0; i < 1000; i++) {
+		if (server.GetConnectionCount() == count)
+			return true;
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+
+	return false;
+}
+
+/*
+ * Connection ceiling of the server: memory per idle connection and the limit of SetMaxConnections()
+ *
+ * Both ends are in this process, so each connection takes two of the open files.
+ */
+static void bench_connections(size_t num_connections, size_t limit)
+{
+	std::cout << "Idle connections" << std::endl;
+
+	rlimit files;
+
+	getrlimit(RLIMIT_NOFILE, &files);
+
+	files.rlim_cur = files.rlim_max;
+
+	setrlimit(RLIMIT_NOFILE, &files);
+
+	num_connections = std::min(num_connections, (size_t)(files.rlim_cur - 100) / 2);
+
+	Voodoo::Server server;
+
+	server.Listen(5003);
+
+	std::thread server_loop([&server]()
+		{
+			server.Run();
+		});
+
+	size_t before = resident_size();
+
+	auto sockets = connect_idle(5003, num_connections);
+
+	if (sockets.size() != num_connections || !wait_connections(server, num_connections))
+		throw std::runtime_error("idle connections not accepted");
+
+	size_t after = resident_size();
+
+	std::cout << "  " << num_connections << " connections accepted, " << (after - before) / num_connections << " bytes per connection" << std::endl;
+
+	for (int fd : sockets)
+		close(fd);
+
+	if (!wait_connections(server, 0))
+		throw std::runtime_error("idle connections not closed");
+
+
+	server.SetMaxConnections(limit);
+
+	sockets = connect_idle(5003, limit * 3);
+
+	/*
+	 * Clients beyond the limit wait in the listen backlog (or fail to connect once it is full).
+	 */
+	std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+	size_t count = server.GetConnectionCount();
+
+	std::cout << "  limit of " << limit << " with " << sockets.size() << " clients connecting: " << count << " connections" << std::endl;
+
+	if (count != limit)
+		throw std::runtime_error("connection limit not held");
+
+	for (int fd : sockets)
+		close(fd);
+
+	server.Stop();
+	server_loop.join();
+}
+
+#endif
+
+
+int main()
+{
+	bench_registry(100000, 10000000);
+	bench_interface(10000000);
+	bench_transport(100000, 1 << 20, 1000);
+#ifdef __linux__
+	bench_connections(10000, 100);
+#endif
+
+	return 0;
+}
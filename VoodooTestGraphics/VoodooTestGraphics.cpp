@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <array>
 #include <iostream>
 
@@ -11,6 +12,155 @@
 
 
 
+/*
+ * Content hash (SHA-256) of uploaded files, which is checked with the server before uploading.
+ *
+ * Resources are shared between clients by their hash, so it has to be collision resistant,
+ * otherwise a client could upload content replacing what the hash of another one resolves to.
+ */
+typedef std::array<sf::Uint8, 32> ContentHash;
+
+static ContentHash hash_content(const void* data, size_t size)
+{
+	static const sf::Uint32 k[64] = {
+		0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+		0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+		0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+		0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+		0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+		0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+		0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+		0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+	};
+
+	sf::Uint32 h[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+
+	auto rotate = [](sf::Uint32 x, int n) { return (x >> n) | (x << (32 - n)); };
+
+	/*
+	 * Padding with a one bit and the length in bits fills the last one or two blocks.
+	 */
+	size_t blocks = (size + 9 + 63) / 64;
+
+	for (size_t b = 0; b < blocks; b++) {
+		sf::Uint8 block[64];
+
+		for (size_t i = 0; i < 64; i++) {
+			size_t pos = b * 64 + i;
+
+			if (pos < size)
+				block[i] = ((const sf::Uint8*)data)[pos];
+			else if (pos == size)
+				block[i] = 0x80;
+			else if (pos >= blocks * 64 - 8)
+				block[i] = (sf::Uint8)((sf::Uint64)size * 8 >> (8 * (blocks * 64 - 1 - pos)));
+			else
+				block[i] = 0;
+		}
+
+		sf::Uint32 w[64];
+
+		for (int i = 0; i < 16; i++)
+			w[i] = (sf::Uint32)block[i * 4] << 24 | (sf::Uint32)block[i * 4 + 1] << 16 | (sf::Uint32)block[i * 4 + 2] << 8 | block[i * 4 + 3];
+
+		for (int i = 16; i < 64; i++)
+			w[i] = w[i - 16] + (rotate(w[i - 15], 7) ^ rotate(w[i - 15], 18) ^ (w[i - 15] >> 3)) +
+				   w[i - 7] + (rotate(w[i - 2], 17) ^ rotate(w[i - 2], 19) ^ (w[i - 2] >> 10));
+
+		sf::Uint32 v[8];
+
+		std::copy(h, h + 8, v);
+
+		for (int i = 0; i < 64; i++) {
+			sf::Uint32 t1 = v[7] + (rotate(v[4], 6) ^ rotate(v[4], 11) ^ rotate(v[4], 25)) + ((v[4] & v[5]) ^ (~v[4] & v[6])) + k[i] + w[i];
+			sf::Uint32 t2 = (rotate(v[0], 2) ^ rotate(v[0], 13) ^ rotate(v[0], 22)) + ((v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]));
+
+			std::copy_backward(v, v + 7, v + 8);
+
+			v[4] += t1;
+			v[0] = t1 + t2;
+		}
+
+		for (int i = 0; i < 8; i++)
+			h[i] += v[i];
+	}
+
+	ContentHash hash;
+
+	for (int i = 0; i < 32; i++)
+		hash[i] = (sf::Uint8)(h[i / 4] >> (24 - 8 * (i % 4)));
+
+	return hash;
+}
+
+
+/*
+ * Text retained on the server, being updated and drawn via IVoodooGraphics
+ */
+class IVoodooText : public Voodoo::InterfaceClient
+{
+public:
+	using Method = enum {
+		RELEASE,
+
+		_NUM_METHODS
+	};
+
+private:
+	friend class IVoodooGraphics;
+
+	/*
+	 * Values last sent to the server (starting with the defaults of sf::Text), unchanged values are not sent again.
+	 */
+	std::string string;
+	int characterSize;
+	sf::Vector2f position;
+	sf::Color color;
+
+public:
+	IVoodooText(Voodoo::Client& client, Voodoo::ID method_id)
+		:
+		InterfaceClient(client, method_id),
+		characterSize(30),
+		color(sf::Color::White)
+	{
+	}
+};
+
+/*
+ * Vertex buffer kept on the server, being updated and drawn via IVoodooGraphics
+ */
+class IVoodooVertexBuffer : public Voodoo::InterfaceClient
+{
+public:
+	using Method = enum {
+		RELEASE,
+
+		_NUM_METHODS
+	};
+
+private:
+	friend class IVoodooGraphics;
+
+	/*
+	 * Vertices last sent to the server, so that only changed ranges are sent.
+	 */
+	std::vector<sf::Vertex> vertices;
+
+public:
+	IVoodooVertexBuffer(Voodoo::Client& client, Voodoo::ID method_id, size_t count)
+		:
+		InterfaceClient(client, method_id),
+		vertices(count)
+	{
+	}
+
+	size_t GetVertexCount() const
+	{
+		return vertices.size();
+	}
+};
+
 class IVoodooGraphics : public Voodoo::InterfaceClient
 {
 public:
@@ -27,31 +177,70 @@ public:
 		CREATE_IMAGE,
 		CREATE_TEXTURE,
 		CREATE_FONT,
-		GET_EVENT,
+		GET_EVENTS,
+		EXECUTE_COMMANDS,
+		CREATE_TEXT,
+		SET_TEXT_STRING,
+		SET_TEXT_SIZE,
+		SET_TEXT_POSITION,
+		SET_TEXT_COLOR,
+		DRAW_TEXT_OBJECT,
+		CREATE_LIST,
+		REPLAY_LIST,
+		LIST_POSITION,	// only used within overrides of REPLAY_LIST
+		CREATE_VERTEXBUFFER,
+		UPDATE_VERTEXBUFFER,
+		DRAW_VERTEXBUFFER,
+		GET_STATISTICS,
+		SET_EVENT_PUSH,
 
 		_NUM_METHODS
 	};
 
+private:
+	/*
+	 * Draw commands are recorded and submitted per frame in FlipDisplay (or Flush).
+	 *
+	 * Interfaces used by recorded commands have to stay alive until then.
+	 */
+	Voodoo::CommandBuffer commands;
+
+	/*
+	 * Commands of a display list being recorded and commands replacing ones of a list being replayed.
+	 */
+	Voodoo::CommandBuffer list;
+	Voodoo::CommandBuffer overrides;
+
+	Voodoo::CommandBuffer* target;
+
 public:
 	IVoodooGraphics(Voodoo::Client& client, Voodoo::ID method_id)
 		:
-		InterfaceClient(client, method_id)
+		InterfaceClient(client, method_id),
+		target(&commands),
+		fetched(false)
+	{
+	}
+
+	~IVoodooGraphics()
 	{
+		if (push_method)
+			client.Unregister(push_method);
 	}
 
 	void FillRectangle(sf::Vector2f pos, sf::Vector2f size, sf::Color color)
 	{
-		client.Call(method_id, (int)FILL_RECTANGLE, pos.x, pos.y, size.x, size.y, color.r, color.g, color.b, color.a);
+		target->Record((int)FILL_RECTANGLE, pos.x, pos.y, size.x, size.y, color.r, color.g, color.b, color.a);
 	}
 
 	void DrawSprite(sf::Vector2f pos, InterfaceClient* texture)
 	{
-		client.Call(method_id, (int)DRAW_SPRITE, pos.x, pos.y, texture->GetMethodID());
+		target->Record((int)DRAW_SPRITE, pos.x, pos.y, texture->GetMethodID());
 	}
 
 	void DrawSpriteScaled(sf::Vector2f pos, sf::Vector2f size, InterfaceClient* texture)
 	{
-		client.Call(method_id, (int)DRAW_SPRITE_SCALED, pos.x, pos.y, size.x, size.y, texture->GetMethodID());
+		target->Record((int)DRAW_SPRITE_SCALED, pos.x, pos.y, size.x, size.y, texture->GetMethodID());
 	}
 
 	class Triangle
@@ -67,7 +256,7 @@ public:
 
 	void TextureTriangle(const Triangle& triangle, InterfaceClient* texture)
 	{
-		client.Call(method_id, (int)TEXTURE_TRIANGLE,
+		target->Record((int)TEXTURE_TRIANGLE,
 			triangle.p1.x, triangle.p1.y,
 			triangle.t1.x, triangle.t1.y,
 			triangle.p2.x, triangle.p2.y,
@@ -79,40 +268,228 @@ public:
 
 	void DrawText(sf::Vector2f pos, InterfaceClient* font, int characterSize, std::string text, sf::Color color)
 	{
-		client.Call(method_id, (int)DRAW_TEXT, pos.x, pos.y, font->GetMethodID(), characterSize, text, color.r, color.g, color.b, color.a);
+		target->Record((int)DRAW_TEXT, pos.x, pos.y, font->GetMethodID(), characterSize, text, color.r, color.g, color.b, color.a);
+	}
+
+	void SetTextString(IVoodooText* text, const std::string& string)
+	{
+		if (string == text->string)
+			return;
+
+		text->string = string;
+
+		target->Record((int)SET_TEXT_STRING, text->GetMethodID(), string);
+	}
+
+	void SetTextSize(IVoodooText* text, int characterSize)
+	{
+		if (characterSize == text->characterSize)
+			return;
+
+		text->characterSize = characterSize;
+
+		target->Record((int)SET_TEXT_SIZE, text->GetMethodID(), characterSize);
+	}
+
+	void SetTextPosition(IVoodooText* text, sf::Vector2f pos)
+	{
+		if (pos == text->position)
+			return;
+
+		text->position = pos;
+
+		target->Record((int)SET_TEXT_POSITION, text->GetMethodID(), pos.x, pos.y);
+	}
+
+	void SetTextColor(IVoodooText* text, sf::Color color)
+	{
+		if (color == text->color)
+			return;
+
+		text->color = color;
+
+		target->Record((int)SET_TEXT_COLOR, text->GetMethodID(), color.r, color.g, color.b, color.a);
+	}
+
+	void DrawText(IVoodooText* text)
+	{
+		target->Record((int)DRAW_TEXT_OBJECT, text->GetMethodID());
 	}
 
 	void RenderVertexArray(const sf::VertexArray& array, InterfaceClient* texture = 0)
 	{
-		client.Call2(method_id, &array[0], array.getVertexCount() * sizeof(array[0]),
-					 (int)RENDER_VERTEXARRAY, array.getVertexCount(), (int)array.getPrimitiveType(),
-					 texture ? texture->GetMethodID() : Voodoo::ID());
+		target->Record2(&array[0], array.getVertexCount() * sizeof(array[0]),
+						 (int)RENDER_VERTEXARRAY, array.getVertexCount(), (int)array.getPrimitiveType(),
+						 texture ? texture->GetMethodID() : Voodoo::ID());
+	}
+
+	/*
+	 * Update vertices of the buffer starting at the offset, sending only the ranges that changed.
+	 */
+	void UpdateVertexBuffer(IVoodooVertexBuffer* buffer, const sf::Vertex* vertices, size_t count, size_t offset = 0)
+	{
+		/*
+		 * Unchanged vertices between changed ones are sent as well, if that is cheaper than another command.
+		 */
+		static const size_t max_gap = 4;
+
+		if (offset > buffer->vertices.size() || count > buffer->vertices.size() - offset)
+			throw std::runtime_error("vertices exceed buffer");
+
+		sf::Vertex* shadow = &buffer->vertices[offset];
+
+		for (size_t i = 0; i < count; ) {
+			if (!memcmp(&shadow[i], &vertices[i], sizeof(sf::Vertex))) {
+				i++;
+				continue;
+			}
+
+			size_t start = i;
+			size_t end = ++i;
+
+			for (; i < count && i - end <= max_gap; i++) {
+				if (memcmp(&shadow[i], &vertices[i], sizeof(sf::Vertex)))
+					end = i + 1;
+			}
+
+			i = end;
+
+			memcpy(&shadow[start], &vertices[start], (end - start) * sizeof(sf::Vertex));
+
+			target->Record2(&vertices[start], (end - start) * sizeof(sf::Vertex),
+							(int)UPDATE_VERTEXBUFFER, buffer->GetMethodID(), (sf::Uint64)(offset + start));
+		}
+	}
+
+	void DrawVertexBuffer(IVoodooVertexBuffer* buffer, InterfaceClient* texture = 0)
+	{
+		DrawVertexBuffer(buffer, 0, buffer->GetVertexCount(), texture);
+	}
+
+	void DrawVertexBuffer(IVoodooVertexBuffer* buffer, size_t first, size_t count, InterfaceClient* texture = 0)
+	{
+		target->Record((int)DRAW_VERTEXBUFFER, buffer->GetMethodID(), (sf::Uint64)first, (sf::Uint64)count,
+					   texture ? texture->GetMethodID() : Voodoo::ID());
+	}
+
+	/*
+	 * Record the following commands into a display list instead of the frame, until EndList.
+	 *
+	 * As texts and vertex buffers only send changed values, lists should draw them, but not change them.
+	 */
+	void BeginList()
+	{
+		list.Clear();
+
+		target = &list;
+	}
+
+	/*
+	 * Position of the next command in the list being recorded, for replacing commands when replaying it.
+	 */
+	sf::Uint32 GetListPosition() const
+	{
+		return (sf::Uint32)list.GetCount();
+	}
+
+	/*
+	 * Create the display list on the server, returning the ID for IVoodooList.
+	 */
+	Voodoo::ID EndList()
+	{
+		target = &commands;
+
+		Flush();
+
+		auto result = client.Call2(method_id, list.GetData(), list.GetSize(), (int)CREATE_LIST);
+
+		list.Clear();
+
+		return std::any_cast<Voodoo::ID>(result[0]);
+	}
+
+	/*
+	 * Record the following commands as replacements of list commands starting at the position, until EndOverride.
+	 *
+	 * Overrides apply to the next ReplayList only.
+	 */
+	void BeginOverride(sf::Uint32 position)
+	{
+		overrides.Record((int)LIST_POSITION, position);
+
+		target = &overrides;
+	}
+
+	void EndOverride()
+	{
+		target = &commands;
+	}
+
+	void ReplayList(InterfaceClient* list)
+	{
+		commands.Record2(overrides.GetData(), overrides.GetSize(), (int)REPLAY_LIST, list->GetMethodID());
+
+		overrides.Clear();
 	}
 
 	void FlipDisplay()
 	{
-		client.Call(method_id, (int)FLIP_DISPLAY);
+		commands.Record((int)FLIP_DISPLAY);
+
+		/*
+		 * Submit the whole frame, waiting for the reply to keep the client in sync with the display.
+		 */
+		client.Call2(method_id, commands.GetData(), commands.GetSize(), (int)EXECUTE_COMMANDS, commands.GetSize());
+
+		commands.Clear();
+	}
+
+	/*
+	 * Submit recorded commands without waiting.
+	 */
+	void Flush()
+	{
+		if (commands.Empty())
+			return;
+
+		client.Post2(method_id, commands.GetData(), commands.GetSize(), (int)EXECUTE_COMMANDS, commands.GetSize());
+
+		commands.Clear();
 	}
 
 	Voodoo::ID CreateImage(int width, int height)
 	{
-		auto result = client.Call(method_id, (int)CREATE_IMAGE, width, height);
+		Flush();
 
-		return std::any_cast<Voodoo::ID>(result[0]);
+		return Call<Voodoo::ID(int, int)>(CREATE_IMAGE, width, height);
 	}
 
 	Voodoo::ID CreateTexture(InterfaceClient* image)
 	{
-		auto result = client.Call(method_id, (int)CREATE_TEXTURE, image->GetMethodID());
+		Flush();
 
-		return std::any_cast<Voodoo::ID>(result[0]);
+		return Call<Voodoo::ID(Voodoo::ID)>(CREATE_TEXTURE, image->GetMethodID());
 	}
 
 	Voodoo::ID CreateFont()
 	{
-		auto result = client.Call(method_id, (int)CREATE_FONT);
+		Flush();
 
-		return std::any_cast<Voodoo::ID>(result[0]);
+		return Call<Voodoo::ID()>(CREATE_FONT);
+	}
+
+	Voodoo::ID CreateVertexBuffer(size_t count, sf::PrimitiveType type)
+	{
+		Flush();
+
+		return Call<Voodoo::ID(sf::Uint64, int)>(CREATE_VERTEXBUFFER, (sf::Uint64)count, (int)type);
+	}
+
+	Voodoo::ID CreateText(InterfaceClient* font)
+	{
+		Flush();
+
+		return Call<Voodoo::ID(Voodoo::ID)>(CREATE_TEXT, font->GetMethodID());
 	}
 
 public:
@@ -140,11 +517,96 @@ public:
 		int    y;		// Motion, Wheel (vertical)
 	};
 
+	/*
+	 * Get the number of draw commands executed by the server and of draw calls they were merged into.
+	 */
+	void GetStatistics(sf::Uint64& draws, sf::Uint64& draw_calls)
+	{
+		Flush();
+
+		auto result = client.Call(method_id, (int)GET_STATISTICS);
+
+		draws = std::any_cast<sf::Uint64>(result[0]);
+		draw_calls = std::any_cast<sf::Uint64>(result[1]);
+	}
+
+	/*
+	 * Let the server push events as they arrive, so GetEvent does not need to fetch them.
+	 *
+	 * The server polls the window every few milliseconds, also while the client is not flipping.
+	 */
+	void EnableEventPush()
+	{
+		if (push_method)
+			return;
+
+		push_method = client.Register<void(int, int, int)>([this](int type, int a, int b)
+			{
+				std::unique_lock<std::mutex> l(events_lock);
+
+				events.push_back(make_event(type, a, b));
+			}).GetID();
+
+		Flush();
+
+		Call<void(Voodoo::ID)>(SET_EVENT_PUSH, push_method);
+	}
+
+	/*
+	 * Get the next event, returning false when there are no more events for this frame.
+	 *
+	 * Unless events are pushed, all pending events are fetched at once when the first event of a frame is requested.
+	 */
 	bool GetEvent(Event& ev)
 	{
-		auto result = client.Call(method_id, (int)GET_EVENT);
+		std::unique_lock<std::mutex> l(events_lock);
+
+		if (events.empty() && !push_method) {
+			if (fetched) {
+				fetched = false;
+				return false;
+			}
+
+			l.unlock();
+
+			Flush();
+
+			auto result = client.Call(method_id, (int)GET_EVENTS);
+
+			l.lock();
+
+			for (size_t i = 0; i + 2 < result.size(); i += 3)
+				events.push_back(make_event(std::any_cast<int>(result[i]), std::any_cast<int>(result[i + 1]), std::any_cast<int>(result[i + 2])));
+
+			fetched = true;
+		}
+
+		if (events.empty()) {
+			fetched = false;
+			return false;
+		}
+
+		ev = events.front();
+
+		events.pop_front();
+
+		return true;
+	}
+
+private:
+	std::mutex events_lock;
+	std::deque<Event> events;
+	bool fetched;				// events of this frame were fetched already
+	Voodoo::ID push_method;		// set if events are pushed by the server
+
+	/*
+	 * Events are sent as type and two arguments each.
+	 */
+	static Event make_event(int type, int a, int b)
+	{
+		Event ev;
 
-		ev.type = (Event::Type)std::any_cast<int>(result[0]);
+		ev.type = (Event::Type)type;
 
 		switch (ev.type) {
 		case Event::Type::None:
@@ -153,20 +615,20 @@ public:
 			break;
 		case Event::Type::KeyPressed:
 		case Event::Type::KeyReleased:
-			ev.key = (Event::Key)std::any_cast<int>(result[1]);
+			ev.key = (Event::Key)a;
 			break;
 		case Event::Type::ButtonPressed:
 		case Event::Type::ButtonReleased:
-			ev.button = (Event::Button)std::any_cast<int>(result[1]);
+			ev.button = (Event::Button)a;
 			break;
 		case Event::Type::Motion:
 		case Event::Type::Wheel:
-			ev.x = std::any_cast<int>(result[1]);
-			ev.y = std::any_cast<int>(result[2]);
+			ev.x = a;
+			ev.y = b;
 			break;
 		}
 
-		return ev.type != Event::Type::None;
+		return ev;
 	}
 };
 
@@ -178,6 +640,7 @@ public:
 
 		WRITE,
 		LOAD,
+		LOAD_CACHED,
 
 		_NUM_METHODS
 	};
@@ -189,10 +652,30 @@ public:
 	{
 	}
 
+	/*
+	 * Write pixels of the rectangle, reading rows of the source at the given pitch.
+	 *
+	 * Large rectangles are streamed in bands of rows, each band being a single one-way message
+	 * carrying the source rows as they are, so no reply is awaited and nothing is copied here.
+	 */
 	void Write(sf::IntRect rect, const void* data, int pitch)
 	{
-		for (int y = 0; y < rect.height; y++)
-			client.Call2(method_id, (const char*)data + pitch * y, rect.width * 4, (int)WRITE, rect.left, rect.top + y, rect.width);
+		static const size_t band_size = 1 << 20;
+
+		if (rect.width <= 0 || rect.height <= 0)
+			return;
+
+		if (pitch < rect.width * 4)
+			throw std::runtime_error("pitch smaller than row");
+
+		int band_rows = std::max(1, (int)(band_size / pitch));
+
+		for (int y = 0; y < rect.height; y += band_rows) {
+			int rows = std::min(band_rows, rect.height - y);
+
+			client.Post2(method_id, (const char*)data + (size_t)pitch * y, (size_t)pitch * (rows - 1) + rect.width * 4,
+						 (int)WRITE, rect.left, rect.top + y, rect.width, rows, pitch);
+		}
 	}
 
 	void LoadFromFile(std::string filename)
@@ -200,9 +683,9 @@ public:
 		FILE* f;
 
 #ifdef _WIN32
-		if (fopen_s(&f, filename.c_str(), "r"))
+		if (fopen_s(&f, filename.c_str(), "rb"))
 #else
-		if ((f = fopen(filename.c_str(), "r")) == NULL)
+		if ((f = fopen(filename.c_str(), "rb")) == NULL)
 #endif
 			throw std::runtime_error(filename);
 
@@ -218,7 +701,13 @@ public:
 		//std::cout << "size " << size << "  " << (int)((const char*)buf)[0] << "  " << (int)((const char*)buf)[1] << std::endl;
 		std::cout << "size " << size << "  " << (const char*)buf << std::endl;
 
-		client.Call2(method_id, buf, size, (int)LOAD, (int)size);
+		/*
+		 * Upload only if the server does not have the content already.
+		 */
+		ContentHash hash = hash_content(buf, size);
+
+		if (!Call<int(Voodoo::Data, sf::Uint64)>(LOAD_CACHED, Voodoo::Data(hash.data(), hash.size()), (sf::Uint64)size))
+			client.Call2(method_id, buf, size, (int)LOAD, (int)size);
 
 		fclose(f);
 
@@ -243,6 +732,26 @@ public:
 	}
 };
 
+/*
+ * Display list recorded by IVoodooGraphics::BeginList/EndList
+ */
+class IVoodooList : public Voodoo::InterfaceClient
+{
+public:
+	using Method = enum {
+		RELEASE,
+
+		_NUM_METHODS
+	};
+
+public:
+	IVoodooList(Voodoo::Client& client, Voodoo::ID method_id)
+		:
+		InterfaceClient(client, method_id)
+	{
+	}
+};
+
 class IVoodooFont : public Voodoo::InterfaceClient
 {
 public:
@@ -250,6 +759,7 @@ public:
 		RELEASE,
 
 		LOAD,
+		LOAD_CACHED,
 
 		_NUM_METHODS
 	};
@@ -266,9 +776,9 @@ public:
 		FILE* f;
 
 #ifdef _WIN32
-		if (fopen_s(&f, filename.c_str(), "r"))
+		if (fopen_s(&f, filename.c_str(), "rb"))
 #else
-		if ((f = fopen(filename.c_str(), "r")) == NULL)
+		if ((f = fopen(filename.c_str(), "rb")) == NULL)
 #endif
 			throw std::runtime_error(filename);
 
@@ -284,7 +794,13 @@ public:
 		//std::cout << "size " << size << "  " << (int)((const char*)buf)[0] << "  " << (int)((const char*)buf)[1] << std::endl;
 		std::cout << "size " << size << "  " << (const char*)buf << std::endl;
 
-		client.Call2(method_id, buf, size, (int)LOAD, (int)size);
+		/*
+		 * Upload only if the server does not have the content already.
+		 */
+		ContentHash hash = hash_content(buf, size);
+
+		if (!Call<int(Voodoo::Data, sf::Uint64)>(LOAD_CACHED, Voodoo::Data(hash.data(), hash.size()), (sf::Uint64)size))
+			client.Call2(method_id, buf, size, (int)LOAD, (int)size);
 
 		fclose(f);
 
@@ -294,327 +810,698 @@ public:
 
 
 
-class IVoodooImage_Server : public Voodoo::InterfaceServer<IVoodooImage>
+/*
+ * Decoded resources being shared by all clients, looked up by content hash and size of the uploaded file.
+ *
+ * Knowing the SHA-256 of a file is as good as having it, so clients only get resources they could upload.
+ *
+ * Entries are dropped once the last interface using the resource has been released.
+ */
+template <typename T>
+class ResourceCache
 {
 private:
-	std::array<std::function<std::any(std::vector<std::any>)>, IVoodooImage::_NUM_METHODS> dispatch;
-	sf::Image image;
+	typedef std::pair<ContentHash, sf::Uint64> Key;
+
+	std::mutex lock;
+	std::map<Key, std::weak_ptr<T>> entries;
 
 public:
-	IVoodooImage_Server(Voodoo::Server& server, int width, int height)
-		:
-		InterfaceServer(server)
+	std::shared_ptr<T> Lookup(const ContentHash& hash, sf::Uint64 size)
 	{
-		image.create(width, height);
+		std::unique_lock<std::mutex> l(lock);
 
-		dispatch[IVoodooImage::WRITE] = [this](std::vector<std::any> args) -> std::any
-		{
-			write_image(std::any_cast<int>(args[1]),
-						std::any_cast<int>(args[2]),
-						std::any_cast<int>(args[3]),
-						std::any_cast<const void*>(args[4]));
+		auto entry = entries.find(Key(hash, size));
 
-			return 0;
-		};
+		if (entry == entries.end())
+			return NULL;
 
-		dispatch[IVoodooImage::LOAD] = [this](std::vector<std::any> args) -> std::any
-		{
-			//std::cout << (const char*)std::any_cast<const void*>(args[2]) << std::endl;
-			image.loadFromMemory(std::any_cast<const void*>(args[2]), std::any_cast<int>(args[1]));
-			//image.loadFromFile("bitmap.png");
+		auto resource = entry->second.lock();
 
-			return 0;
-		};
-	}
+		if (!resource)
+			entries.erase(entry);
 
-	virtual std::function<std::any(std::vector<std::any>)> Lookup(IVoodooImage::Method method) const
-	{
-		return dispatch[method];
+		return resource;
 	}
 
-	sf::Image& GetImage()
+	/*
+	 * Add decoded resource, returning the resource of a concurrent upload of the same content instead.
+	 */
+	std::shared_ptr<T> Insert(const ContentHash& hash, sf::Uint64 size, std::shared_ptr<T> resource)
 	{
-		return image;
-	}
+		std::unique_lock<std::mutex> l(lock);
 
-private:
-	void write_image(int x, int y, int width, const void* data)
-	{
-		sf::Image src;
+		for (auto entry = entries.begin(); entry != entries.end(); ) {
+			if (entry->second.expired())
+				entry = entries.erase(entry);
+			else
+				entry++;
+		}
+
+		auto& entry = entries[Key(hash, size)];
 
-		src.create(width, 1, (const sf::Uint8*)data);
+		if (auto existing = entry.lock())
+			return existing;
 
-		image.copy(src, x, y);
+		entry = resource;
+
+		return resource;
 	}
 };
 
-class IVoodooTexture_Server : public Voodoo::InterfaceServer<IVoodooTexture>
+class Resources
 {
-private:
-	std::array<std::function<std::any(std::vector<std::any>)>, IVoodooTexture::_NUM_METHODS> dispatch;
-	sf::Texture texture;
-
 public:
-	IVoodooTexture_Server(Voodoo::Server& server, IVoodooImage_Server* image)
-		:
-		InterfaceServer(server)
+	class Pixels
 	{
-		texture.loadFromImage(image->GetImage());
-	}
+	public:
+		sf::Vector2u size;
+		std::vector<sf::Uint8> data;
+	};
 
-	virtual std::function<std::any(std::vector<std::any>)> Lookup(IVoodooTexture::Method method) const
+	/*
+	 * Font being loaded from the uploaded file, which SFML reads from while the font is in use.
+	 *
+	 * Glyphs are rendered on demand into the cache of the font, so drawing with a shared font
+	 * has to be serialized.
+	 */
+	class Font
 	{
-		return dispatch[method];
-	}
+	public:
+		std::vector<sf::Uint8> file;
+		std::mutex lock;
+		sf::Font font;
+	};
 
-	sf::Texture& GetTexture()
-	{
-		return texture;
-	}
+	ResourceCache<const Pixels> images;
+	ResourceCache<Font> fonts;
 };
 
-class IVoodooFont_Server : public Voodoo::InterfaceServer<IVoodooFont>
+
+class IVoodooImage_Server : public Voodoo::InterfaceServer<IVoodooImage>
 {
 private:
-	std::array<std::function<std::any(std::vector<std::any>)>, IVoodooFont::_NUM_METHODS> dispatch;
-	sf::Font font;
+	Resources& resources;
+
+	/*
+	 * Pixels are kept here instead of in an sf::Image, which has no writable access to its pixels.
+	 *
+	 * Pixels of loaded files are shared with other images, they are copied before being written.
+	 */
+	std::shared_ptr<const Resources::Pixels> pixels;
+	Resources::Pixels* writable;
 
 public:
-	IVoodooFont_Server(Voodoo::Server& server)
+	IVoodooImage_Server(Voodoo::Server& server, Resources& resources, int width, int height)
 		:
-		InterfaceServer(server)
+		InterfaceServer(server),
+		resources(resources)
 	{
-		dispatch[IVoodooFont::LOAD] = [this](std::vector<std::any> args) -> std::any
-		{
-			//std::cout << (const char*)std::any_cast<const void*>(args[2]) << std::endl;
-			//font.loadFromMemory(std::any_cast<const void*>(args[2]), std::any_cast<int>(args[1]));
-			font.loadFromFile("FreeSans.ttf");
+		auto own = std::make_shared<Resources::Pixels>();
 
-			return 0;
-		};
-	}
+		own->size = sf::Vector2u(std::max(width, 0), std::max(height, 0));
+		own->data.resize((size_t)own->size.x * own->size.y * 4);
 
-	virtual std::function<std::any(std::vector<std::any>)> Lookup(IVoodooFont::Method method) const
-	{
-		return dispatch[method];
+		pixels = own;
+		writable = own.get();
+
+		SetOneWay(IVoodooImage::WRITE);
+
+		Bind<&IVoodooImage_Server::write>(IVoodooImage::WRITE);
+		Bind<&IVoodooImage_Server::load>(IVoodooImage::LOAD);
+		Bind<&IVoodooImage_Server::load_cached>(IVoodooImage::LOAD_CACHED);
 	}
 
-	sf::Font& GetFont()
+	sf::Vector2u GetSize() const
 	{
-		return font;
+		return pixels->size;
+	}
+
+	const sf::Uint8* GetPixels() const
+	{
+		return pixels->data.data();
+	}
+
+private:
+	void write(int x, int y, int width, int height, int pitch, Voodoo::Data data)
+	{
+		auto size = pixels->size;
+
+		if (x < 0 || y < 0 || width < 0 || height < 0 ||
+			(unsigned)x + width > size.x || (unsigned)y + height > size.y)
+			throw std::runtime_error("rectangle exceeds image");
+
+		if (!width || !height)
+			return;
+
+		size_t row_size = (size_t)width * 4;
+
+		if ((size_t)pitch < row_size || data.size() < (size_t)pitch * (height - 1) + row_size)
+			throw std::runtime_error("rectangle exceeds data");
+
+		if (!writable) {
+			auto own = std::make_shared<Resources::Pixels>(*pixels);
+
+			pixels = own;
+			writable = own.get();
+		}
+
+		for (int row = 0; row < height; row++)
+			memcpy(&writable->data[((size_t)(y + row) * size.x + x) * 4], data.data() + (size_t)pitch * row, row_size);
+	}
+
+	void load(std::vector<std::any> args)
+	{
+		auto data = std::any_cast<Voodoo::Data>(args[2]);
+
+		sf::Image image;
+
+		if (!image.loadFromMemory(data.data(), data.size()))
+			return;
+
+		auto decoded = std::make_shared<Resources::Pixels>();
+
+		decoded->size = image.getSize();
+		decoded->data.assign(image.getPixelsPtr(), image.getPixelsPtr() + (size_t)decoded->size.x * decoded->size.y * 4);
+
+		pixels = resources.images.Insert(hash_content(data.data(), data.size()), data.size(), decoded);
+		writable = NULL;
+	}
+
+	int load_cached(Voodoo::Data hash, sf::Uint64 size)
+	{
+		if (hash.size() != sizeof(ContentHash))
+			throw std::runtime_error("invalid content hash");
+
+		ContentHash key;
+
+		std::copy(hash.begin(), hash.end(), key.begin());
+
+		auto cached = resources.images.Lookup(key, size);
+
+		if (!cached)
+			return 0;
+
+		pixels = cached;
+		writable = NULL;
+
+		return 1;
 	}
 };
 
+class IVoodooTexture_Server : public Voodoo::InterfaceServer<IVoodooTexture>
+{
+private:
+	sf::Texture texture;
 
-class IVoodooGraphics_Server : public Voodoo::InterfaceServer<IVoodooGraphics>
+public:
+	IVoodooTexture_Server(Voodoo::Server& server, IVoodooImage_Server* image)
+		:
+		InterfaceServer(server)
+	{
+		auto size = image->GetSize();
+
+		if (size.x && size.y && texture.create(size.x, size.y))
+			texture.update(image->GetPixels());
+	}
+
+	sf::Texture& GetTexture()
+	{
+		return texture;
+	}
+};
+
+class IVoodooFont_Server : public Voodoo::InterfaceServer<IVoodooFont>
 {
 private:
-	std::array<std::function<std::any(std::vector<std::any>)>, IVoodooGraphics::_NUM_METHODS> dispatch;
-	sf::RenderWindow window;
+	Resources& resources;
+	std::shared_ptr<Resources::Font> font;
 
 public:
-	IVoodooGraphics_Server(Voodoo::Server& server)
+	IVoodooFont_Server(Voodoo::Server& server, Resources& resources)
 		:
 		InterfaceServer(server),
-		window(sf::VideoMode(1024, 768), "Voodoo Graphics")
+		resources(resources),
+		font(std::make_shared<Resources::Font>())
 	{
-		dispatch[IVoodooGraphics::FILL_RECTANGLE] = [this](std::vector<std::any> args) -> std::any
-		{
-			fill_rectangle(args);
+		Bind<&IVoodooFont_Server::load>(IVoodooFont::LOAD);
+		Bind<&IVoodooFont_Server::load_cached>(IVoodooFont::LOAD_CACHED);
+	}
 
-			return 0;
-		};
+	const std::shared_ptr<Resources::Font>& GetFont() const
+	{
+		return font;
+	}
 
-		dispatch[IVoodooGraphics::DRAW_SPRITE] = [this](std::vector<std::any> args) -> std::any
-		{
-			draw_sprite(args);
+private:
+	void load(std::vector<std::any> args)
+	{
+		auto data = std::any_cast<Voodoo::Data>(args[2]);
 
-			return 0;
-		};
+		auto decoded = std::make_shared<Resources::Font>();
 
-		dispatch[IVoodooGraphics::DRAW_SPRITE_SCALED] = [this](std::vector<std::any> args) -> std::any
-		{
-			draw_sprite_scaled(args);
+		decoded->file.assign(data.begin(), data.end());
 
-			return 0;
-		};
+		if (!decoded->font.loadFromMemory(decoded->file.data(), decoded->file.size()))
+			return;
 
-		dispatch[IVoodooGraphics::TEXTURE_TRIANGLE] = [this](std::vector<std::any> args) -> std::any
-		{
-			texture_triangle(args);
+		font = resources.fonts.Insert(hash_content(data.data(), data.size()), data.size(), decoded);
+	}
 
-			return 0;
-		};
+	int load_cached(Voodoo::Data hash, sf::Uint64 size)
+	{
+		if (hash.size() != sizeof(ContentHash))
+			throw std::runtime_error("invalid content hash");
 
-		dispatch[IVoodooGraphics::DRAW_TEXT] = [this](std::vector<std::any> args) -> std::any
-		{
-			draw_text(args);
+		ContentHash key;
 
-			return 0;
-		};
+		std::copy(hash.begin(), hash.end(), key.begin());
 
-		dispatch[IVoodooGraphics::RENDER_VERTEXARRAY] = [this](std::vector<std::any> args) -> std::any
-		{
-			render_vertexarray(args);
+		auto cached = resources.fonts.Lookup(key, size);
 
+		if (!cached)
 			return 0;
-		};
 
-		dispatch[IVoodooGraphics::FLIP_DISPLAY] = [this](std::vector<std::any> args) -> std::any
-		{
-			flip_display();
+		font = cached;
 
-			return 0;
-		};
+		return 1;
+	}
+};
 
-		dispatch[IVoodooGraphics::CREATE_IMAGE] = [this,&server](std::vector<std::any> args) -> std::any
-		{
-			auto image = new IVoodooImage_Server(server, std::any_cast<int>(args[1]), std::any_cast<int>(args[2]));
 
-			return image->GetMethodID();
-		};
+/*
+ * The font is kept for the lifetime of the text, geometry is only rebuilt by SFML if string or size change.
+ */
+class IVoodooText_Server : public Voodoo::InterfaceServer<IVoodooText>
+{
+private:
+	std::shared_ptr<Resources::Font> font;
+	sf::Text text;
 
-		dispatch[IVoodooGraphics::CREATE_TEXTURE] = [this,&server](std::vector<std::any> args) -> std::any
-		{
-			auto texture = new IVoodooTexture_Server(server, (IVoodooImage_Server*)server.LookupInterface(std::any_cast<Voodoo::ID>(args[1])));
+public:
+	IVoodooText_Server(Voodoo::Server& server, IVoodooFont_Server* font)
+		:
+		InterfaceServer(server),
+		font(font->GetFont())
+	{
+		text.setFont(this->font->font);
+	}
 
-			return texture->GetMethodID();
-		};
+	Resources::Font& GetFont()
+	{
+		return *font;
+	}
 
-		dispatch[IVoodooGraphics::CREATE_FONT] = [this,&server](std::vector<std::any> args) -> std::any
-		{
-			auto font = new IVoodooFont_Server(server);
+	sf::Text& GetText()
+	{
+		return text;
+	}
+};
 
-			return font->GetMethodID();
-		};
 
-		dispatch[IVoodooGraphics::GET_EVENT] = [this](std::vector<std::any> args) -> std::any
-		{
-			return get_event();
-		};
+/*
+ * Vertices are kept in an sf::VertexBuffer if supported, otherwise in memory.
+ */
+class IVoodooVertexBuffer_Server : public Voodoo::InterfaceServer<IVoodooVertexBuffer>
+{
+public:
+	/*
+	 * Limit of vertices per buffer or array, so a single request cannot make the server allocate arbitrary amounts.
+	 */
+	static const size_t max_vertices = 1 << 22;
+
+private:
+	sf::PrimitiveType type;
+	sf::VertexBuffer buffer;
+	std::vector<sf::Vertex> vertices;
+	size_t count;
+	bool hardware;
+
+public:
+	IVoodooVertexBuffer_Server(Voodoo::Server& server, size_t count, sf::PrimitiveType type)
+		:
+		InterfaceServer(server),
+		type(type),
+		buffer(type, sf::VertexBuffer::Dynamic),
+		vertices(count),
+		count(count),
+		hardware(false)
+	{
+		if (sf::VertexBuffer::isAvailable() && buffer.create(count) && buffer.update(vertices.data())) {
+			std::vector<sf::Vertex>().swap(vertices);
+
+			hardware = true;
+		}
+	}
+
+	/*
+	 * Update from vertices as received, which are not necessarily aligned.
+	 */
+	void Update(size_t offset, Voodoo::Data update)
+	{
+		size_t num = update.size() / sizeof(sf::Vertex);
+
+		if (offset > count || num > count - offset)
+			throw std::runtime_error("vertices exceed buffer");
+
+		if (!num)
+			return;
+
+		if (hardware) {
+			std::vector<sf::Vertex> copy(num);
+
+			memcpy(copy.data(), update.data(), num * sizeof(sf::Vertex));
+
+			buffer.update(copy.data(), num, (unsigned int)offset);
+		}
+		else
+			memcpy(&vertices[offset], update.data(), num * sizeof(sf::Vertex));
 	}
 
-	virtual std::function<std::any(std::vector<std::any>)> Lookup(IVoodooGraphics::Method method) const
+	void Draw(sf::RenderTarget& target, size_t first, size_t num, const sf::RenderStates& states)
 	{
-		return dispatch[method];
+		if (first > count || num > count - first)
+			throw std::runtime_error("vertices exceed buffer");
+
+		if (!num)
+			return;
+
+		if (hardware)
+			target.draw(buffer, first, num, states);
+		else
+			target.draw(&vertices[first], num, type, states);
 	}
+};
 
+/*
+ * Commands are kept as recorded, interfaces used by them have to stay alive as long as the list is replayed.
+ */
+class IVoodooList_Server : public Voodoo::InterfaceServer<IVoodooList>
+{
 private:
-	void fill_rectangle(std::vector<std::any> args)
+	std::vector<sf::Uint8> commands;
+
+public:
+	IVoodooList_Server(Voodoo::Server& server, Voodoo::Data commands)
+		:
+		InterfaceServer(server),
+		commands(commands.begin(), commands.end())
+	{
+	}
+
+	const std::vector<sf::Uint8>& GetCommands() const
 	{
-		sf::Vector2f pos;
-		sf::Vector2f size;
-		sf::Color color;
+		return commands;
+	}
+};
 
-		pos.x = std::any_cast<float>(args[1]);
-		pos.y = std::any_cast<float>(args[2]);
 
-		size.x = std::any_cast<float>(args[3]);
-		size.y = std::any_cast<float>(args[4]);
+class IVoodooGraphics_Server : public Voodoo::InterfaceServer<IVoodooGraphics>
+{
+private:
+	Resources& resources;
+	sf::RenderWindow window;
 
-		color.r = std::any_cast<sf::Uint8>(args[5]);
-		color.g = std::any_cast<sf::Uint8>(args[6]);
-		color.b = std::any_cast<sf::Uint8>(args[7]);
-		color.a = std::any_cast<sf::Uint8>(args[8]);
+	/*
+	 * Position of the next list command being replaced while reading the overrides of REPLAY_LIST.
+	 */
+	sf::Uint32 override_position;
+
+	/*
+	 * Consecutive sprites, rectangles and triangles with the same texture are drawn as one triangle list.
+	 */
+	sf::VertexArray batch;
+	const sf::Texture* batch_texture;
+	bool batching;
+
+	/*
+	 * Vertices of RENDER_VERTEXARRAY copied out of the request, being reused for each call.
+	 */
+	std::vector<sf::Vertex> vertex_array;
+
+	/*
+	 * Number of draw commands and of draw calls they resulted in, see GET_STATISTICS.
+	 */
+	sf::Uint64 draws;
+	sf::Uint64 draw_calls;
+
+	/*
+	 * Client and method receiving events as they arrive, see SET_EVENT_PUSH.
+	 */
+	Voodoo::Server::ClientID push_client;
+	Voodoo::ID push_method;
 
-		sf::RectangleShape rect;
+public:
+	IVoodooGraphics_Server(Voodoo::Server& server, Resources& resources)
+		:
+		InterfaceServer(server),
+		resources(resources),
+		window(sf::VideoMode(1024, 768), "Voodoo Graphics"),
+		override_position(0),
+		batch(sf::Triangles),
+		batch_texture(NULL),
+		batching(false),
+		draws(0),
+		draw_calls(0)
+	{
+		SetOneWay(IVoodooGraphics::FILL_RECTANGLE);
+		SetOneWay(IVoodooGraphics::DRAW_SPRITE);
+		SetOneWay(IVoodooGraphics::DRAW_SPRITE_SCALED);
+		SetOneWay(IVoodooGraphics::TEXTURE_TRIANGLE);
+		SetOneWay(IVoodooGraphics::DRAW_TEXT);
+		SetOneWay(IVoodooGraphics::RENDER_VERTEXARRAY);
+		SetOneWay(IVoodooGraphics::EXECUTE_COMMANDS);
+		SetOneWay(IVoodooGraphics::SET_TEXT_STRING);
+		SetOneWay(IVoodooGraphics::SET_TEXT_SIZE);
+		SetOneWay(IVoodooGraphics::SET_TEXT_POSITION);
+		SetOneWay(IVoodooGraphics::SET_TEXT_COLOR);
+		SetOneWay(IVoodooGraphics::DRAW_TEXT_OBJECT);
+		SetOneWay(IVoodooGraphics::REPLAY_LIST);
+		SetOneWay(IVoodooGraphics::UPDATE_VERTEXBUFFER);
+		SetOneWay(IVoodooGraphics::DRAW_VERTEXBUFFER);
+
+		Bind<&IVoodooGraphics_Server::fill_rectangle>(IVoodooGraphics::FILL_RECTANGLE);
+		Bind<&IVoodooGraphics_Server::draw_sprite>(IVoodooGraphics::DRAW_SPRITE);
+		Bind<&IVoodooGraphics_Server::draw_sprite_scaled>(IVoodooGraphics::DRAW_SPRITE_SCALED);
+		Bind<&IVoodooGraphics_Server::texture_triangle>(IVoodooGraphics::TEXTURE_TRIANGLE);
+		Bind<&IVoodooGraphics_Server::draw_text>(IVoodooGraphics::DRAW_TEXT);
+		Bind<&IVoodooGraphics_Server::render_vertexarray>(IVoodooGraphics::RENDER_VERTEXARRAY);
+		Bind<&IVoodooGraphics_Server::flip_display>(IVoodooGraphics::FLIP_DISPLAY);
+		Bind<&IVoodooGraphics_Server::create_image>(IVoodooGraphics::CREATE_IMAGE);
+		Bind<&IVoodooGraphics_Server::create_texture>(IVoodooGraphics::CREATE_TEXTURE);
+		Bind<&IVoodooGraphics_Server::create_font>(IVoodooGraphics::CREATE_FONT);
+		Bind<&IVoodooGraphics_Server::get_events>(IVoodooGraphics::GET_EVENTS);
+		Bind<&IVoodooGraphics_Server::execute_commands>(IVoodooGraphics::EXECUTE_COMMANDS);
+		Bind<&IVoodooGraphics_Server::create_text>(IVoodooGraphics::CREATE_TEXT);
+		Bind<&IVoodooGraphics_Server::set_text_string>(IVoodooGraphics::SET_TEXT_STRING);
+		Bind<&IVoodooGraphics_Server::set_text_size>(IVoodooGraphics::SET_TEXT_SIZE);
+		Bind<&IVoodooGraphics_Server::set_text_position>(IVoodooGraphics::SET_TEXT_POSITION);
+		Bind<&IVoodooGraphics_Server::set_text_color>(IVoodooGraphics::SET_TEXT_COLOR);
+		Bind<&IVoodooGraphics_Server::draw_text_object>(IVoodooGraphics::DRAW_TEXT_OBJECT);
+		Bind<&IVoodooGraphics_Server::create_list>(IVoodooGraphics::CREATE_LIST);
+		Bind<&IVoodooGraphics_Server::replay_list>(IVoodooGraphics::REPLAY_LIST);
+		Bind<&IVoodooGraphics_Server::list_position>(IVoodooGraphics::LIST_POSITION);
+		Bind<&IVoodooGraphics_Server::create_vertexbuffer>(IVoodooGraphics::CREATE_VERTEXBUFFER);
+		Bind<&IVoodooGraphics_Server::update_vertexbuffer>(IVoodooGraphics::UPDATE_VERTEXBUFFER);
+		Bind<&IVoodooGraphics_Server::draw_vertexbuffer>(IVoodooGraphics::DRAW_VERTEXBUFFER);
+		Bind<&IVoodooGraphics_Server::get_statistics>(IVoodooGraphics::GET_STATISTICS);
+		Bind<&IVoodooGraphics_Server::set_event_push>(IVoodooGraphics::SET_EVENT_PUSH);
+	}
 
-		rect.setPosition(pos);
-		rect.setSize(size);
-		rect.setFillColor(color);
+	virtual ~IVoodooGraphics_Server()
+	{
+		server.RemoveTimer(method_id);
+	}
 
-		window.draw(rect);
+private:
+	void fill_rectangle(float x, float y, float w, float h, sf::Uint8 r, sf::Uint8 g, sf::Uint8 b, sf::Uint8 a)
+	{
+		batch_quad(NULL, sf::FloatRect(x, y, w, h), sf::FloatRect(), sf::Color(r, g, b, a));
 	}
 
-	void draw_sprite(std::vector<std::any> args)
+	void draw_sprite(float x, float y, Voodoo::ID texture_id)
 	{
-		sf::Vector2f pos;
-		IVoodooTexture_Server* texture = (IVoodooTexture_Server*)server.LookupInterface(std::any_cast<Voodoo::ID>(args[3]));
+		IVoodooTexture_Server* texture = (IVoodooTexture_Server*)server.LookupInterface(texture_id);
 
-		pos.x = std::any_cast<float>(args[1]);
-		pos.y = std::any_cast<float>(args[2]);
+		sf::Vector2f size(texture->GetTexture().getSize());
 
+		batch_quad(&texture->GetTexture(), sf::FloatRect(sf::Vector2f(x, y), size), sf::FloatRect(sf::Vector2f(), size), sf::Color::White);
+	}
 
-		sf::Sprite sprite;
+	void draw_sprite_scaled(float x, float y, float w, float h, Voodoo::ID texture_id)
+	{
+		IVoodooTexture_Server* texture = (IVoodooTexture_Server*)server.LookupInterface(texture_id);
 
-		sprite.setTexture(texture->GetTexture());
-		sprite.setPosition(pos);
+		sf::Vector2f size(texture->GetTexture().getSize());
 
-		window.draw(sprite);
+		batch_quad(&texture->GetTexture(), sf::FloatRect(x, y, w, h), sf::FloatRect(sf::Vector2f(), size), sf::Color::White);
 	}
 
-	void draw_sprite_scaled(std::vector<std::any> args)
+	void texture_triangle(float x1, float y1, float u1, float v1,
+						  float x2, float y2, float u2, float v2,
+						  float x3, float y3, float u3, float v3, Voodoo::ID texture_id)
 	{
-		sf::Vector2f pos, size;
-		IVoodooTexture_Server* texture = (IVoodooTexture_Server*)server.LookupInterface(std::any_cast<Voodoo::ID>(args[5]));
+		IVoodooTexture_Server* texture = (IVoodooTexture_Server*)server.LookupInterface(texture_id);
 
-		pos.x = std::any_cast<float>(args[1]);
-		pos.y = std::any_cast<float>(args[2]);
+		batch_begin(&texture->GetTexture());
 
-		size.x = std::any_cast<float>(args[3]);
-		size.y = std::any_cast<float>(args[4]);
+		batch.append(sf::Vertex(sf::Vector2f(x1, y1), sf::Vector2f(u1, v1)));
+		batch.append(sf::Vertex(sf::Vector2f(x2, y2), sf::Vector2f(u2, v2)));
+		batch.append(sf::Vertex(sf::Vector2f(x3, y3), sf::Vector2f(u3, v3)));
+
+		batch_end();
+	}
 
+	/*
+	 * Start adding a draw to the batch, which is drawn first if the texture differs.
+	 */
+	void batch_begin(const sf::Texture* texture)
+	{
+		if (texture != batch_texture)
+			flush_batch();
 
-		sf::Sprite sprite;
+		batch_texture = texture;
 
-		sprite.setTexture(texture->GetTexture());
-		sprite.setPosition(pos);
+		draws++;
+	}
 
-		window.draw(sprite);
+	/*
+	 * Finish adding a draw to the batch, draws are only batched within submitted commands.
+	 */
+	void batch_end()
+	{
+		if (!batching)
+			flush_batch();
 	}
 
-	void texture_triangle(std::vector<std::any> args)
+	void batch_quad(const sf::Texture* texture, sf::FloatRect rect, sf::FloatRect tex, sf::Color color)
 	{
-		IVoodooTexture_Server* texture = (IVoodooTexture_Server*)server.LookupInterface(std::any_cast<Voodoo::ID>(args[13]));
+		batch_begin(texture);
+
+		sf::Vertex v0(sf::Vector2f(rect.left, rect.top), color, sf::Vector2f(tex.left, tex.top));
+		sf::Vertex v1(sf::Vector2f(rect.left + rect.width, rect.top), color, sf::Vector2f(tex.left + tex.width, tex.top));
+		sf::Vertex v2(sf::Vector2f(rect.left + rect.width, rect.top + rect.height), color, sf::Vector2f(tex.left + tex.width, tex.top + tex.height));
+		sf::Vertex v3(sf::Vector2f(rect.left, rect.top + rect.height), color, sf::Vector2f(tex.left, tex.top + tex.height));
+
+		batch.append(v0);
+		batch.append(v1);
+		batch.append(v2);
+		batch.append(v0);
+		batch.append(v2);
+		batch.append(v3);
 
-		sf::VertexArray vertices(sf::Triangles, 3);
+		batch_end();
+	}
 
-		vertices[0].position.x = std::any_cast<float>(args[1]);
-		vertices[0].position.y = std::any_cast<float>(args[2]);
-		vertices[0].texCoords.x = std::any_cast<float>(args[3]);
-		vertices[0].texCoords.y = std::any_cast<float>(args[4]);
-		vertices[1].position.x = std::any_cast<float>(args[5]);
-		vertices[1].position.y = std::any_cast<float>(args[6]);
-		vertices[1].texCoords.x = std::any_cast<float>(args[7]);
-		vertices[1].texCoords.y = std::any_cast<float>(args[8]);
-		vertices[2].position.x = std::any_cast<float>(args[9]);
-		vertices[2].position.y = std::any_cast<float>(args[10]);
-		vertices[2].texCoords.x = std::any_cast<float>(args[11]);
-		vertices[2].texCoords.y = std::any_cast<float>(args[12]);
+	/*
+	 * Draw the batch, which has to happen before anything else is drawn.
+	 */
+	void flush_batch()
+	{
+		if (!batch.getVertexCount())
+			return;
 
 		sf::RenderStates states = sf::RenderStates::Default;
 
-		states.texture = &texture->GetTexture();
+		states.texture = batch_texture;
+
+		window.draw(batch, states);
+
+		draw_calls++;
+
+		batch.clear();
+	}
+
+	/*
+	 * Count a draw not being batched, drawing the batch first.
+	 */
+	void unbatched_draw()
+	{
+		flush_batch();
 
-		window.draw(&vertices[0], 3, sf::Triangles, states);
+		draws++;
+		draw_calls++;
 	}
 
-	void draw_text(std::vector<std::any> args)
+	void draw_text(float x, float y, Voodoo::ID font_id, int characterSize, std::string string, sf::Uint8 r, sf::Uint8 g, sf::Uint8 b, sf::Uint8 a)
 	{
-		IVoodooFont_Server* font = (IVoodooFont_Server*)server.LookupInterface(std::any_cast<Voodoo::ID>(args[3]));
+		IVoodooFont_Server* font = (IVoodooFont_Server*)server.LookupInterface(font_id);
+
+		std::unique_lock<std::mutex> l(font->GetFont()->lock);
+
+		unbatched_draw();
 
 		sf::Text text;
 
-		text.setFont(font->GetFont());
-		text.setPosition(sf::Vector2f(std::any_cast<float>(args[1]), std::any_cast<float>(args[2])));
-		text.setCharacterSize(std::any_cast<int>(args[4]));
-		text.setString(std::any_cast<std::string>(args[5]));
-		text.setFillColor(sf::Color(std::any_cast<sf::Uint8>(args[6]),
-			std::any_cast<sf::Uint8>(args[7]),
-			std::any_cast<sf::Uint8>(args[8]),
-			std::any_cast<sf::Uint8>(args[9])));
+		text.setFont(font->GetFont()->font);
+		text.setPosition(sf::Vector2f(x, y));
+		text.setCharacterSize(characterSize);
+		text.setString(string);
+		text.setFillColor(sf::Color(r, g, b, a));
 
-		//std::cout << "Drawing text: " << std::any_cast<std::string>(args[5]) << std::endl;
+		//std::cout << "Drawing text: " << string << std::endl;
 
 		window.draw(text);
 	}
 
+	void set_text_string(Voodoo::ID text_id, std::string string)
+	{
+		IVoodooText_Server* text = (IVoodooText_Server*)server.LookupInterface(text_id);
+
+		text->GetText().setString(string);
+	}
+
+	void set_text_size(Voodoo::ID text_id, int characterSize)
+	{
+		IVoodooText_Server* text = (IVoodooText_Server*)server.LookupInterface(text_id);
+
+		text->GetText().setCharacterSize(characterSize);
+	}
+
+	void set_text_position(Voodoo::ID text_id, float x, float y)
+	{
+		IVoodooText_Server* text = (IVoodooText_Server*)server.LookupInterface(text_id);
+
+		text->GetText().setPosition(sf::Vector2f(x, y));
+	}
+
+	void set_text_color(Voodoo::ID text_id, sf::Uint8 r, sf::Uint8 g, sf::Uint8 b, sf::Uint8 a)
+	{
+		IVoodooText_Server* text = (IVoodooText_Server*)server.LookupInterface(text_id);
+
+		text->GetText().setFillColor(sf::Color(r, g, b, a));
+	}
+
+	void draw_text_object(Voodoo::ID text_id)
+	{
+		IVoodooText_Server* text = (IVoodooText_Server*)server.LookupInterface(text_id);
+
+		std::unique_lock<std::mutex> l(text->GetFont().lock);
+
+		unbatched_draw();
+
+		window.draw(text->GetText());
+	}
+
 	void render_vertexarray(std::vector<std::any> args)
 	{
 		auto num = std::any_cast<sf::Uint64>(args[1]);
 		auto type = std::any_cast<int>(args[2]);
 		auto tex = std::any_cast<Voodoo::ID>(args[3]);
-		const sf::Vertex* v = static_cast<const sf::Vertex*>(std::any_cast<const void*>(args[4]));
+		auto data = std::any_cast<Voodoo::Data>(args[4]);
+
+		if (num > IVoodooVertexBuffer_Server::max_vertices)
+			throw std::runtime_error("too many vertices");
+
+		if (data.size() < num * sizeof(sf::Vertex))
+			throw std::runtime_error("vertex array exceeds data");
+
+		/*
+		 * Received data is not necessarily aligned for sf::Vertex.
+		 */
+		vertex_array.resize(num);
+
+		memcpy(vertex_array.data(), data.data(), num * sizeof(sf::Vertex));
 
 		sf::RenderStates states = sf::RenderStates::Default;
 
@@ -624,69 +1511,280 @@ private:
 			states.texture = &texture->GetTexture();
 		}
 
-		sf::VertexArray arr((sf::PrimitiveType)type, num);
+		unbatched_draw();
+
+		window.draw(vertex_array.data(), num, (sf::PrimitiveType)type, states);
+	}
+
+	void update_vertexbuffer(Voodoo::ID buffer_id, sf::Uint64 offset, Voodoo::Data data)
+	{
+		IVoodooVertexBuffer_Server* buffer = (IVoodooVertexBuffer_Server*)server.LookupInterface(buffer_id);
+
+		buffer->Update(offset, data);
+	}
+
+	void draw_vertexbuffer(Voodoo::ID buffer_id, sf::Uint64 first, sf::Uint64 count, Voodoo::ID texture_id)
+	{
+		IVoodooVertexBuffer_Server* buffer = (IVoodooVertexBuffer_Server*)server.LookupInterface(buffer_id);
+
+		sf::RenderStates states = sf::RenderStates::Default;
+
+		if (texture_id) {
+			IVoodooTexture_Server* texture = (IVoodooTexture_Server*)server.LookupInterface(texture_id);
+
+			states.texture = &texture->GetTexture();
+		}
+
+		unbatched_draw();
 
-		/* FIXME: can we use memcpy instead? */
-		for (size_t i = 0; i < num; i++)
-			arr[i] = v[i];
+		buffer->Draw(window, first, count, states);
+	}
+
+	void execute_commands(std::vector<std::any> args)
+	{
+		auto size = std::any_cast<sf::Uint64>(args[1]);
+		auto data = std::any_cast<Voodoo::Data>(args[2]);
+
+		if (data.size() < size)
+			throw std::runtime_error("command buffer exceeds data");
+
+		/*
+		 * Interfaces used by the batch may be released after the submitted commands, so it is drawn at the end.
+		 */
+		batching = true;
+
+		try {
+			Voodoo::CommandBuffer::Execute(data.data(), size, [this](int method, Voodoo::Reader& command)
+				{
+					execute_command(method, command, false);
+				});
+		}
+		catch (...) {
+			batching = false;
+			batch.clear();
+			throw;
+		}
+
+		batching = false;
 
-		window.draw(arr, states);
+		flush_batch();
+	}
+
+	/*
+	 * Execute a submitted command or a command of a display list (which must not replay other lists).
+	 */
+	void execute_command(int method, Voodoo::Reader& command, bool replaying)
+	{
+		switch (method) {
+		case IVoodooGraphics::REPLAY_LIST:
+			if (replaying)
+				throw std::runtime_error("nested display list");
+			/* fall through */
+		case IVoodooGraphics::FILL_RECTANGLE:
+		case IVoodooGraphics::DRAW_SPRITE:
+		case IVoodooGraphics::DRAW_SPRITE_SCALED:
+		case IVoodooGraphics::TEXTURE_TRIANGLE:
+		case IVoodooGraphics::DRAW_TEXT:
+		case IVoodooGraphics::RENDER_VERTEXARRAY:
+		case IVoodooGraphics::FLIP_DISPLAY:
+		case IVoodooGraphics::SET_TEXT_STRING:
+		case IVoodooGraphics::SET_TEXT_SIZE:
+		case IVoodooGraphics::SET_TEXT_POSITION:
+		case IVoodooGraphics::SET_TEXT_COLOR:
+		case IVoodooGraphics::DRAW_TEXT_OBJECT:
+		case IVoodooGraphics::UPDATE_VERTEXBUFFER:
+		case IVoodooGraphics::DRAW_VERTEXBUFFER:
+			Invoke((IVoodooGraphics::Method)method, command, NULL);
+			break;
+		default:
+			throw std::runtime_error("invalid command");
+		}
+	}
+
+	/*
+	 * Execute the commands of the list, replacing the ones at positions given by the overrides.
+	 */
+	void replay_list(Voodoo::ID list_id, Voodoo::Data overrides)
+	{
+		IVoodooList_Server* list = (IVoodooList_Server*)server.LookupInterface(list_id);
+
+		/*
+		 * Readers of the overrides point into the submitted commands, which stay valid during the replay.
+		 */
+		std::map<sf::Uint32, std::pair<int, Voodoo::Reader>> replaced;
+
+		override_position = 0;
+
+		Voodoo::CommandBuffer::Execute(overrides.data(), overrides.size(), [&](int method, Voodoo::Reader& command)
+			{
+				if (method == IVoodooGraphics::LIST_POSITION)
+					Invoke(IVoodooGraphics::LIST_POSITION, command, NULL);
+				else
+					replaced.insert_or_assign(override_position++, std::make_pair(method, command));
+			});
+
+		sf::Uint32 position = 0;
+
+		Voodoo::CommandBuffer::Execute(list->GetCommands().data(), list->GetCommands().size(), [&](int method, Voodoo::Reader& command)
+			{
+				auto replacement = replaced.find(position++);
+
+				if (replacement != replaced.end())
+					execute_command(replacement->second.first, replacement->second.second, true);
+				else
+					execute_command(method, command, true);
+			});
 	}
 
 	void flip_display()
 	{
+		flush_batch();
+
 		window.display();
 
 		window.clear();
 	}
 
-	std::vector<std::any> get_event()
+	Voodoo::ID create_image(int width, int height)
+	{
+		auto image = new IVoodooImage_Server(server, resources, width, height);
+
+		return image->GetMethodID();
+	}
+
+	Voodoo::ID create_texture(Voodoo::ID image)
+	{
+		auto texture = new IVoodooTexture_Server(server, (IVoodooImage_Server*)server.LookupInterface(image));
+
+		return texture->GetMethodID();
+	}
+
+	Voodoo::ID create_font()
+	{
+		auto font = new IVoodooFont_Server(server, resources);
+
+		return font->GetMethodID();
+	}
+
+	void list_position(sf::Uint32 position)
+	{
+		override_position = position;
+	}
+
+	Voodoo::ID create_list(Voodoo::Data commands)
+	{
+		auto list = new IVoodooList_Server(server, commands);
+
+		return list->GetMethodID();
+	}
+
+	Voodoo::ID create_vertexbuffer(sf::Uint64 count, int type)
+	{
+		if (count > IVoodooVertexBuffer_Server::max_vertices)
+			throw std::runtime_error("too many vertices");
+
+		auto buffer = new IVoodooVertexBuffer_Server(server, count, (sf::PrimitiveType)type);
+
+		return buffer->GetMethodID();
+	}
+
+	Voodoo::ID create_text(Voodoo::ID font)
+	{
+		auto text = new IVoodooText_Server(server, (IVoodooFont_Server*)server.LookupInterface(font));
+
+		return text->GetMethodID();
+	}
+
+	std::vector<std::any> get_statistics(std::vector<std::any>)
+	{
+		return { draws, draw_calls };
+	}
+
+	std::vector<std::any> get_events(std::vector<std::any>)
 	{
 		std::vector<std::any> ret;
 
+		for (auto& event : poll_events()) {
+			ret.push_back(event[0]);
+			ret.push_back(event[1]);
+			ret.push_back(event[2]);
+		}
+
+		return ret;
+	}
+
+	/*
+	 * Poll the window with a timer of the server, independent of the client flipping.
+	 *
+	 * Timers are called by the thread running Run(), which also handles all requests (no workers)
+	 * and thereby owns the window, so polling does not race with the handlers drawing to it.
+	 */
+	void set_event_push(Voodoo::ID method)
+	{
+		push_client = server.GetCurrentClient();
+		push_method = method;
+
+		server.AddTimer(method_id, std::chrono::milliseconds(5), [this]()
+			{
+				push_events();
+			});
+	}
+
+	/*
+	 * Push pending events to the client, stopping when it is gone.
+	 */
+	void push_events()
+	{
+		for (auto& event : poll_events()) {
+			if (!server.Post(push_client, push_method, event[0], event[1], event[2])) {
+				server.RemoveTimer(method_id);
+				break;
+			}
+		}
+	}
+
+	/*
+	 * Poll all pending events as type and two arguments each, consecutive motion events are coalesced.
+	 */
+	std::vector<std::array<int, 3>> poll_events()
+	{
+		std::vector<std::array<int, 3>> events;
+
 		sf::Event event;
 
-		if (window.pollEvent(event)) {
+		while (window.pollEvent(event)) {
 			switch (event.type) {
 			case sf::Event::Closed:
 				window.close();
-				ret.push_back((int)IVoodooGraphics::Event::Type::WindowClosed);
+				events.push_back({ (int)IVoodooGraphics::Event::Type::WindowClosed, 0, 0 });
 				break;
 			case sf::Event::KeyPressed:
-				ret.push_back((int)IVoodooGraphics::Event::Type::KeyPressed);
-				ret.push_back((int)event.key.code);
+				events.push_back({ (int)IVoodooGraphics::Event::Type::KeyPressed, (int)event.key.code, 0 });
 				break;
 			case sf::Event::KeyReleased:
-				ret.push_back((int)IVoodooGraphics::Event::Type::KeyReleased);
-				ret.push_back((int)event.key.code);
+				events.push_back({ (int)IVoodooGraphics::Event::Type::KeyReleased, (int)event.key.code, 0 });
 				break;
 			case sf::Event::MouseButtonPressed:
-				ret.push_back((int)IVoodooGraphics::Event::Type::ButtonPressed);
-				ret.push_back((int)event.mouseButton.button);
+				events.push_back({ (int)IVoodooGraphics::Event::Type::ButtonPressed, (int)event.mouseButton.button, 0 });
 				break;
 			case sf::Event::MouseButtonReleased:
-				ret.push_back((int)IVoodooGraphics::Event::Type::ButtonReleased);
-				ret.push_back((int)event.mouseButton.button);
+				events.push_back({ (int)IVoodooGraphics::Event::Type::ButtonReleased, (int)event.mouseButton.button, 0 });
 				break;
 			case sf::Event::MouseMoved:
-				ret.push_back((int)IVoodooGraphics::Event::Type::Motion);
-				ret.push_back(event.mouseMove.x);
-				ret.push_back(event.mouseMove.y);
+				if (!events.empty() && events.back()[0] == (int)IVoodooGraphics::Event::Type::Motion)
+					events.pop_back();
+
+				events.push_back({ (int)IVoodooGraphics::Event::Type::Motion, event.mouseMove.x, event.mouseMove.y });
 				break;
 			default:
-				ret.push_back((int)IVoodooGraphics::Event::Type::None);
 				break;
 			}
 		}
-		else
-			ret.push_back((int)IVoodooGraphics::Event::Type::None);
 
-		return ret;
+		return events;
 	}
 };
 
-
-
 int main()
 {
 	parallel_f::system::instance().setDebugLevel("Voodoo::Host", 0);
@@ -705,10 +1803,15 @@ int main()
 
 	std::unique_ptr<std::thread> server_loop;
 
+	/*
+	 * Images and fonts loaded by clients are shared by all of them.
+	 */
+	Resources resources;
+
 	if (setup.test_server) {
-		graphics_id = server.Register([&server](std::vector<std::any> args)
+		graphics_id = server.Register([&server, &resources](std::vector<std::any>)
 			{
-				auto graphics = new IVoodooGraphics_Server(server);
+				auto graphics = new IVoodooGraphics_Server(server, resources);
 
 				return graphics->GetMethodID();
 			});
@@ -725,6 +1828,8 @@ int main()
 
 		auto graphics = new IVoodooGraphics(client, std::any_cast<Voodoo::ID>(result[0]));
 
+		graphics->EnableEventPush();
+
 
 		sf::Image img;
 
@@ -750,6 +1855,84 @@ int main()
 		font->LoadFromFile("FreeSans.ttf");
 
 
+		auto text = new IVoodooText(client, graphics->CreateText(font));
+
+		graphics->SetTextString(text, "Text Example");
+		graphics->SetTextSize(text, 23);
+		graphics->SetTextPosition(text, sf::Vector2f(100, 100));
+		graphics->SetTextColor(text, sf::Color(230, 230, 230, 255));
+
+		auto another_text = new IVoodooText(client, graphics->CreateText(font));
+
+		graphics->SetTextString(another_text, "Another Text Example");
+		graphics->SetTextPosition(another_text, sf::Vector2f(150, 130));
+		graphics->SetTextColor(another_text, sf::Color(250, 250, 250, 255));
+
+		auto fps_text = new IVoodooText(client, graphics->CreateText(font));
+
+		graphics->SetTextPosition(fps_text, sf::Vector2f(850, 30));
+		graphics->SetTextColor(fps_text, sf::Color(250, 50, 50, 255));
+
+		auto stats_text = new IVoodooText(client, graphics->CreateText(font));
+
+		graphics->SetTextSize(stats_text, 16);
+		graphics->SetTextPosition(stats_text, sf::Vector2f(10, 740));
+
+
+		sf::VertexArray va(sf::PrimitiveType::TrianglesFan, 7);
+
+		va[0] = sf::Vertex(sf::Vector2f(400.0f, 300.0f), sf::Color(255, 255, 255));
+
+		for (int i = 1; i < 7; i++)
+			va[i] = sf::Vertex(va[0].position + sf::Vector2f(i*50.0f, 300.0f-i*40.0f), sf::Color(i*190, 200-i*30, i*40));
+
+		auto fan = new IVoodooVertexBuffer(client, graphics->CreateVertexBuffer(va.getVertexCount(), va.getPrimitiveType()), va.getVertexCount());
+
+		graphics->UpdateVertexBuffer(fan, &va[0], va.getVertexCount());
+
+
+		/*
+		 * Record the static part of the scene once as a display list.
+		 */
+		graphics->BeginList();
+
+		graphics->FillRectangle(sf::Vector2f(100, 100), sf::Vector2f(400, 300), sf::Color(255, 0, 0, 255));
+		graphics->FillRectangle(sf::Vector2f(300, 150), sf::Vector2f(400, 300), sf::Color(0, 0, 255, 255));
+		graphics->FillRectangle(sf::Vector2f(150, 300), sf::Vector2f(400, 300), sf::Color(100, 100, 100, 255));
+
+		sf::Uint32 sprites = graphics->GetListPosition();
+
+		graphics->DrawSprite(sf::Vector2f(110, 110), texture);
+		graphics->DrawSprite(sf::Vector2f(300, 200), texture);
+		graphics->DrawSprite(sf::Vector2f(140, 350), texture);
+
+
+		IVoodooGraphics::Triangle triangle;
+
+		triangle.p1.x = 10;
+		triangle.p1.y = 10;
+		triangle.t1.x = 0;
+		triangle.t1.y = 0;
+		triangle.p2.x = 200;
+		triangle.p2.y = 10;
+		triangle.t2.x = 500;
+		triangle.t2.y = 0;
+		triangle.p3.x = 10;
+		triangle.p3.y = 200;
+		triangle.t3.x = 0;
+		triangle.t3.y = 500;
+
+		graphics->TextureTriangle(triangle, texture);
+
+		graphics->DrawText(text);
+		graphics->DrawText(another_text);
+
+
+		graphics->DrawVertexBuffer(fan);
+
+		auto scene = new IVoodooList(client, graphics->EndList());
+
+
 		std::vector<sf::Vector2f> points;
 
 		bool windowClosed = false;
@@ -757,58 +1940,50 @@ int main()
 		sf::Clock clock;
 		int       frames = 0;
 		char      fps[10] = "";
+		char      stats[64] = "";
 
 		while (!windowClosed) {
 			if (clock.getElapsedTime().asSeconds() >= 2) {
 				snprintf( fps, 10, "%4.1f FPS", frames / clock.restart().asSeconds() );
 				frames = 0;
+
+				sf::Uint64 draws, draw_calls;
+
+				graphics->GetStatistics(draws, draw_calls);
+
+				snprintf( stats, sizeof(stats), "%llu of %llu draws merged", (unsigned long long)(draws - draw_calls), (unsigned long long)draws );
 			}
 
 			frames++;
 
-			graphics->FillRectangle(sf::Vector2f(100, 100), sf::Vector2f(400, 300), sf::Color(255, 0, 0, 255));
-			graphics->FillRectangle(sf::Vector2f(300, 150), sf::Vector2f(400, 300), sf::Color(0, 0, 255, 255));
-			graphics->FillRectangle(sf::Vector2f(150, 300), sf::Vector2f(400, 300), sf::Color(100, 100, 100, 255));
+			/*
+			 * Only the sprite positions of the scene change per frame.
+			 */
+			graphics->BeginOverride(sprites);
 
 			graphics->DrawSprite(sf::Vector2f((float)(110 + rand() % 100), (float)(110 + rand() % 100)), texture);
 			graphics->DrawSprite(sf::Vector2f((float)(300 + rand() % 100), (float)(200 + rand() % 100)), texture);
 			graphics->DrawSprite(sf::Vector2f((float)(140 + rand() % 100), (float)(350 + rand() % 100)), texture);
 
-			for (auto p : points)
-				graphics->FillRectangle(p, sf::Vector2f(10, 10), sf::Color(100, 255, 100, 255));
-
-
-			IVoodooGraphics::Triangle triangle;
+			graphics->EndOverride();
 
-			triangle.p1.x = 10;
-			triangle.p1.y = 10;
-			triangle.t1.x = 0;
-			triangle.t1.y = 0;
-			triangle.p2.x = 200;
-			triangle.p2.y = 10;
-			triangle.t2.x = 500;
-			triangle.t2.y = 0;
-			triangle.p3.x = 10;
-			triangle.p3.y = 200;
-			triangle.t3.x = 0;
-			triangle.t3.y = 500;
+			/*
+			 * Only the changed center vertex of the fan is sent.
+			 */
+			va[0].color.b = (sf::Uint8)(frames * 4);
 
-			graphics->TextureTriangle(triangle, texture);
+			graphics->UpdateVertexBuffer(fan, &va[0], va.getVertexCount());
 
-			graphics->DrawText(sf::Vector2f(100, 100), font, 23, "Text Example", sf::Color(230, 230, 230, 255));
-			graphics->DrawText(sf::Vector2f(150, 130), font, 30, "Another Text Example", sf::Color(250, 250, 250, 255));
+			graphics->ReplayList(scene);
 
-			graphics->DrawText(sf::Vector2f(850, 30), font, 30, fps, sf::Color(250, 50, 50, 255));
-
-
-			sf::VertexArray va(sf::PrimitiveType::TrianglesFan, 7);
-
-			va[0] = sf::Vertex(sf::Vector2f(400.0f, 300.0f), sf::Color(255, 255, 255));
+			for (auto p : points)
+				graphics->FillRectangle(p, sf::Vector2f(10, 10), sf::Color(100, 255, 100, 255));
 
-			for (int i = 1; i < 7; i++)
-				va[i] = sf::Vertex(va[0].position + sf::Vector2f(i*50.0f, 300.0f-i*40.0f), sf::Color(i*190, 200-i*30, i*40));
+			graphics->SetTextString(fps_text, fps);
+			graphics->DrawText(fps_text);
 
-			graphics->RenderVertexArray(va);
+			graphics->SetTextString(stats_text, stats);
+			graphics->DrawText(stats_text);
 
 
 			graphics->FlipDisplay();
@@ -840,6 +2015,12 @@ int main()
 		}
 
 
+		delete scene;
+		delete fan;
+		delete stats_text;
+		delete fps_text;
+		delete another_text;
+		delete text;
 		delete font;
 		delete texture;
 		delete image;
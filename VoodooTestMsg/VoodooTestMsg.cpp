@@ -1,38 +1,51 @@
-#include <array>
 #include <iostream>
-#include <queue>
+#include <mutex>
 #include <set>
 
 #include "Voodoo.h"
 #include "VoodooTest.h"
 
 
+/*
+ * Lines are encoded once for all members of a room.
+ */
+typedef Voodoo::Message<void(std::string)> Line;
+
 class Member
 {
 public:
-	virtual void PutLine(std::string text) = 0;
+	virtual void PutLine(const Line& line) = 0;
 };
 
 class Room
 {
 private:
+	std::mutex lock;
 	std::set<Member*> members;
 
 public:
 	void Enter(Member* member)
 	{
+		std::unique_lock<std::mutex> l(lock);
+
 		members.insert(member);
 	}
 
 	void Leave(Member* member)
 	{
+		std::unique_lock<std::mutex> l(lock);
+
 		members.erase(member);
 	}
 
 	void Write(const std::string& text)
 	{
+		Line line(text);
+
+		std::unique_lock<std::mutex> l(lock);
+
 		for (auto m : members)
-			m->PutLine(text);
+			m->PutLine(line);
 	}
 };
 
@@ -43,12 +56,16 @@ public:
 	using Method = enum {
 		RELEASE,
 
-		RECV_MSG,
+		LISTEN,
 		SEND_MSG,
 
 		_NUM_METHODS
 	};
 
+private:
+	Voodoo::Method<void(std::string)> on_line;
+	Voodoo::Method<std::string()> get_name;
+
 public:
 	IMsg(Voodoo::Client& client, Voodoo::ID method_id)
 		:
@@ -56,16 +73,38 @@ public:
 	{
 	}
 
-	std::string RecvMsg()
+	virtual ~IMsg()
 	{
-		auto result = client.Call(method_id, (int)RECV_MSG);
+		if (on_line.GetID())
+			client.Unregister(on_line.GetID());
 
-		return std::any_cast<std::string>(result[0]);
+		if (get_name.GetID())
+			client.Unregister(get_name.GetID());
+	}
+
+	/*
+	 * Enter the room, lines are pushed by the server and printed by the receiver thread.
+	 *
+	 * The server calls back to ask for the name being shown with our lines.
+	 */
+	void Listen(std::string name)
+	{
+		on_line = client.Register<void(std::string)>([](std::string text)
+			{
+				std::cout << "> \"" << text << "\"" << std::endl;
+			});
+
+		get_name = client.Register<std::string()>([name]()
+			{
+				return name;
+			});
+
+		Call<void(Voodoo::ID, Voodoo::ID)>(LISTEN, on_line.GetID(), get_name.GetID());
 	}
 
 	void SendMsg(std::string msg)
 	{
-		client.Call(method_id, (int)SEND_MSG, msg);
+		Post<void(std::string)>(SEND_MSG, msg);
 	}
 };
 
@@ -73,9 +112,24 @@ public:
 class IMsg_Server : public Voodoo::InterfaceServer<IMsg>, public Member
 {
 private:
+	/*
+	 * Shared with the completion asking for the name, which may run after the interface was released.
+	 */
+	class Presence
+	{
+	public:
+		std::mutex lock;
+		IMsg_Server* member;	// NULL once released
+
+		Presence(IMsg_Server* member) : member(member) {}
+	};
+
 	Room& room;
-	std::array<std::function<std::any(std::vector<std::any>)>, IMsg::_NUM_METHODS> dispatch;
-	std::queue<std::string> messages;
+	Voodoo::Server::ClientID client;
+	Voodoo::Method<void(std::string)> on_line;
+	std::mutex lock;
+	std::string name;	// set once the client replied, protected by lock
+	std::shared_ptr<Presence> presence;	// set by listen
 
 public:
 	IMsg_Server(Voodoo::Server& server, Room &room)
@@ -83,42 +137,86 @@ public:
 		InterfaceServer(server),
 		room(room)
 	{
-		room.Enter(this);
-
-		dispatch[IMsg::RECV_MSG] = [this](std::vector<std::any> args) -> std::any
-		{
-			if (messages.empty())
-				return std::string();
+		SetOneWay(IMsg::SEND_MSG);
 
-			std::string msg = messages.front();
+		Bind<&IMsg_Server::listen>(IMsg::LISTEN);
+		Bind<&IMsg_Server::send_msg>(IMsg::SEND_MSG);
+	}
 
-			messages.pop();
+	virtual ~IMsg_Server()
+	{
+		if (!presence)
+			return;
 
-			return msg;
-		};
+		std::unique_lock<std::mutex> l(presence->lock);
 
-		dispatch[IMsg::SEND_MSG] = [&room](std::vector<std::any> args) -> std::any
-		{
-			room.Write(std::any_cast<std::string>(args[1]));
+		presence->member = NULL;
 
-			return 0;
-		};
+		room.Leave(this);
 	}
 
-	virtual ~IMsg_Server()
+public:
+	virtual void PutLine(const Line& line)
 	{
-		room.Leave(this);
+		server.Post(client, on_line, line);
 	}
 
-	virtual std::function<std::any(std::vector<std::any>)> Lookup(IMsg::Method method) const
+private:
+	/*
+	 * Do not block the worker on the client, which may never reply or disconnect meanwhile.
+	 *
+	 * The member enters the room once the name has arrived. If the client disconnects before,
+	 * the completion is dropped. If the client releases the interface before, the completion
+	 * finds the presence cleared and does not enter.
+	 */
+	void listen(Voodoo::ID line_method, Voodoo::ID name_method)
 	{
-		return dispatch[method];
+		if (presence)
+			throw std::runtime_error("already listening");
+
+		client = server.GetCurrentClient();
+		on_line = Voodoo::Method<void(std::string)>(line_method);
+		presence = std::make_shared<Presence>(this);
+
+		server.CallAsync([presence = presence](std::vector<std::any> result)
+			{
+				if (result.empty() || result[0].type() != typeid(std::string))
+					return;
+
+				std::unique_lock<std::mutex> l(presence->lock);
+
+				IMsg_Server* member = presence->member;
+
+				if (!member)
+					return;
+
+				std::unique_lock<std::mutex> nl(member->lock);
+
+				member->name = std::any_cast<std::string>(result[0]);
+
+				nl.unlock();
+
+				member->room.Enter(member);
+			}, client, name_method);
 	}
 
-public:
-	virtual void PutLine(std::string text)
+	void send_msg(std::string text)
 	{
-		messages.push(text);
+		if (text == "/stats") {
+			auto stats = server.GetQueueStatistics();
+
+			server.Post(client, on_line, std::to_string(stats.packets) + " lines queued (" + std::to_string(stats.bytes) + " bytes), " +
+						std::to_string(stats.dropped) + " dropped, " + std::to_string(stats.disconnects) + " members disconnected");
+			return;
+		}
+
+		std::unique_lock<std::mutex> l(lock);
+
+		std::string line = name + ": " + text;
+
+		l.unlock();
+
+		room.Write(line);
 	}
 };
 
@@ -128,18 +226,20 @@ int main()
 {
 	Room room;
 
-	Voodoo::Server server;
+	Voodoo::Server server(4);	// Members of a room are handled by 4 worker threads
 	Voodoo::Client client;
 
+	server.SetQueueLimit(1 << 20, Voodoo::Server::DROP_OLDEST);	// Members not keeping up lose old lines
+
 	VoodooTest::Setup setup(server, client);
 
 
-	Voodoo::ID msg_id = 1;	// In this case we know the ID that is used on the server to register
+	Voodoo::Method<Voodoo::ID()> create_msg(1);	// In this case we know the ID that is used on the server to register
 
 	std::unique_ptr<std::thread> server_loop;
 
 	if (setup.test_server) {
-		msg_id = server.Register([&server,&room](std::vector<std::any> args)
+		create_msg = server.Register<Voodoo::ID()>([&server,&room]()
 			{
 				auto msg = new IMsg_Server(server, room);
 
@@ -154,24 +254,16 @@ int main()
 
 
 	if (setup.test_client) {
-		auto result = client.Call(msg_id);
-
-		auto msg = new IMsg(client, std::any_cast<Voodoo::ID>(result[0]));
-
-		while (true) {
-			while (true) {
-				std::string message = msg->RecvMsg();
+		auto msg = new IMsg(client, client.Call(create_msg));
 
-				if (message.empty())
-					break;
+		char text[100];
 
-				std::cout << "> \"" << message << "\"" << std::endl;
-			}
+		std::cout << "name: ";
+		(std::cin >> std::ws).getline(text, 100);
 
-			char text[100];
+		msg->Listen(text);
 
-			std::cout << "> ";
-			std::cin.getline(text, 100);
+		while (std::cin.getline(text, 100)) {
 
 			msg->SendMsg(text);
 		}